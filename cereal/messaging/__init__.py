@@ -58,36 +58,26 @@ def sub_sock(endpoint: str, poller: Optional[Poller] = None, addr: str = "127.0.
 def drain_sock_raw(sock: SubSocket, wait_for_one: bool = False) -> List[bytes]:
   """Receive all message currently available on the queue"""
   ret: List[bytes] = []
-  while 1:
-    if wait_for_one and len(ret) == 0:
-      dat = sock.receive()
-    else:
-      dat = sock.receive(non_blocking=True)
 
+  if wait_for_one:
+    dat = sock.receive()
     if dat is None:
-      break
-
+      return ret
     ret.append(dat)
 
-  return ret
-
-def drain_sock(sock: SubSocket, wait_for_one: bool = False) -> List[capnp.lib.capnp._DynamicStructReader]:
-  """Receive all message currently available on the queue"""
-  ret: List[capnp.lib.capnp._DynamicStructReader] = []
   while 1:
-    if wait_for_one and len(ret) == 0:
-      dat = sock.receive()
-    else:
-      dat = sock.receive(non_blocking=True)
-
-    if dat is None:  # Timeout hit
+    dat = sock.receive_batch()
+    if len(dat) == 0:
       break
 
-    dat = log.Event.from_bytes(dat)
-    ret.append(dat)
+    ret.extend(dat)
 
   return ret
 
+def drain_sock(sock: SubSocket, wait_for_one: bool = False) -> List[capnp.lib.capnp._DynamicStructReader]:
+  """Receive all message currently available on the queue"""
+  return [log.Event.from_bytes(dat) for dat in drain_sock_raw(sock, wait_for_one)]
+
 
 # TODO: print when we drop packets?
 def recv_sock(sock: SubSocket, wait: bool = False) -> Union[None, capnp.lib.capnp._DynamicStructReader]:
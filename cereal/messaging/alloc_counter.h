@@ -0,0 +1,31 @@
+#pragma once
+
+// Counts heap allocations by replacing the global operator new, for the tests and benchmarks that check
+// SubMaster::update and PubMaster::send don't allocate once they're warmed up.
+// It replaces the allocator of the whole program, so include it in one file of a binary of its own.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> num_allocs = 0;
+
+void *operator new(size_t size) {
+  num_allocs++;
+  void *p = malloc(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  free(p);
+}
@@ -1,27 +1,79 @@
+#include <getopt.h>
+
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <map>
+#include <set>
+#include <sstream>
 #include <string>
+#include <vector>
 
 typedef void (*sighandler_t)(int sig);
 
+#include "bridge_frame.h"
 #include "impl_msgq.h"
 #include "impl_zmq.h"
 #include "services.h"
 
+// Forwards msgq services to zmq so they can be subscribed to from another machine, or with
+// an ip and whitelist republishes zmq services of that machine as msgq.
+//
+// Forwarded messages can be thinned out per service with --decimate and --rate. With --batch
+// or --compress the msgq -> zmq side sends frames of several messages (see bridge_frame.h),
+// which the zmq -> msgq side always unpacks again.
+static const char *usage =
+  "usage: %s [options]                      msgq -> zmq\n"
+  "       %s [options] <ip> <service,...>   zmq -> msgq\n"
+  "\n"
+  "  --whitelist service,...  only forward these services (msgq -> zmq)\n"
+  "  --decimate service=n     forward every n-th message of a service\n"
+  "  --rate service=hz        forward at most hz messages per second of a service\n"
+  "  --batch ms               send the messages of each service in frames every ms (msgq -> zmq)\n"
+  "  --batch-bytes bytes      send a frame early once it holds this many bytes, default 256 kB\n"
+  "  --compress zstd|lz4      compress the frames (msgq -> zmq)\n";
+
+static uint64_t nanos_since_epoch() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void sigpipe_handler(int sig) {
   assert(sig == SIGPIPE);
   std::cout << "SIGPIPE received" << std::endl;
 }
 
-static std::vector<std::string> get_services(std::string whitelist_str, bool zmq_to_msgq) {
+static std::set<std::string> split(const std::string &str) {
+  std::set<std::string> items;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) items.insert(item);
+  }
+  return items;
+}
+
+// Parses "service=value" into limits
+static bool parse_limit(const char *arg, std::map<std::string, double> &limits) {
+  std::string s = arg;
+  size_t eq = s.find('=');
+  if (eq == std::string::npos || eq == 0) return false;
+
+  char *end;
+  double value = strtod(s.c_str() + eq + 1, &end);
+  if (*end != '\0' || value <= 0) return false;
+  limits[s.substr(0, eq)] = value;
+  return true;
+}
+
+static std::vector<std::string> get_services(const std::set<std::string> &whitelist) {
   std::vector<std::string> service_list;
   for (const auto& it : services) {
     std::string name = it.name;
-    bool in_whitelist = whitelist_str.find(name) != std::string::npos;
-    if (name == "plusFrame" || name == "uiLayoutState" || (zmq_to_msgq && !in_whitelist)) {
+    if (name == "plusFrame" || name == "uiLayoutState" || (!whitelist.empty() && whitelist.count(name) == 0)) {
       continue;
     }
     service_list.push_back(name);
@@ -29,12 +81,87 @@ static std::vector<std::string> get_services(std::string whitelist_str, bool zmq
   return service_list;
 }
 
+struct Service {
+  std::string name;
+  PubSocket *pub;
+
+  int decimation = 1;
+  uint64_t num_received = 0;
+
+  uint64_t min_interval_ns = 0;
+  uint64_t next_send_ns = 0;
+
+  BridgeFrameEncoder encoder;
+  uint64_t batch_start_ns = 0;
+
+  Service(const std::string &name, PubSocket *pub, BridgeCodec codec) : name(name), pub(pub), encoder(codec) {}
+
+  // Applies decimation and rate limit
+  bool should_forward(uint64_t t) {
+    if (num_received++ % decimation != 0) return false;
+    if (min_interval_ns == 0) return true;
+    if (t < next_send_ns) return false;
+
+    // Stay on the rate's grid, unless the service was quiet for longer than an interval
+    next_send_ns = (t - next_send_ns < min_interval_ns) ? next_send_ns + min_interval_ns : t + min_interval_ns;
+    return true;
+  }
+};
+
 int main(int argc, char** argv) {
   signal(SIGPIPE, (sighandler_t)sigpipe_handler);
 
-  bool zmq_to_msgq = argc > 2;
-  std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
-  std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : "";
+  std::set<std::string> whitelist;
+  std::map<std::string, double> decimations, rates;
+  double batch_ms = 0;
+  size_t batch_bytes = 256 * 1024;
+  BridgeCodec codec = BridgeCodec::NONE;
+
+  const struct option long_options[] = {
+    {"whitelist", required_argument, NULL, 'w'},
+    {"decimate", required_argument, NULL, 'd'},
+    {"rate", required_argument, NULL, 'r'},
+    {"batch", required_argument, NULL, 'b'},
+    {"batch-bytes", required_argument, NULL, 'B'},
+    {"compress", required_argument, NULL, 'c'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    bool ok = true;
+    switch (opt) {
+      case 'w': whitelist = split(optarg); break;
+      case 'd': ok = parse_limit(optarg, decimations); break;
+      case 'r': ok = parse_limit(optarg, rates); break;
+      case 'b': batch_ms = atof(optarg); ok = batch_ms > 0; break;
+      case 'B': batch_bytes = atol(optarg); ok = batch_bytes > 0; break;
+      case 'c': ok = bridge_codec_from_string(optarg, codec) && bridge_codec_supported(codec); break;
+      default: ok = false; break;
+    }
+    if (!ok) {
+      if (opt != 'h') fprintf(stderr, "invalid argument: %s\n", argv[optind - 1]);
+      fprintf(stderr, usage, argv[0], argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  bool zmq_to_msgq = argc - optind >= 2;
+  std::string ip = zmq_to_msgq ? argv[optind] : "127.0.0.1";
+  if (zmq_to_msgq) {
+    whitelist = split(argv[optind + 1]);
+    if (whitelist.empty()) {
+      fprintf(stderr, usage, argv[0], argv[0]);
+      return 1;
+    }
+  }
+
+  // Frames are unpacked on the zmq -> msgq side, msgq consumers expect single messages
+  bool framed = !zmq_to_msgq && (batch_ms > 0 || codec != BridgeCodec::NONE);
+  if (zmq_to_msgq && (batch_ms > 0 || codec != BridgeCodec::NONE)) {
+    fprintf(stderr, "--batch and --compress only apply to msgq -> zmq\n");
+    return 1;
+  }
 
   Poller *poller;
   Context *pub_context;
@@ -49,8 +176,8 @@ int main(int argc, char** argv) {
     sub_context = new MSGQContext();
   }
 
-  std::map<SubSocket*, PubSocket*> sub2pub;
-  for (auto endpoint: get_services(whitelist_str, zmq_to_msgq)) {
+  std::map<SubSocket*, Service*> sub2service;
+  for (auto endpoint: get_services(whitelist)) {
     PubSocket * pub_sock;
     SubSocket * sub_sock;
     if (zmq_to_msgq) {
@@ -63,16 +190,65 @@ int main(int argc, char** argv) {
     pub_sock->connect(pub_context, endpoint);
     sub_sock->connect(sub_context, endpoint, ip, false);
 
+    Service *service = new Service(endpoint, pub_sock, codec);
+    if (decimations.count(endpoint)) service->decimation = std::max(1, (int)decimations[endpoint]);
+    if (rates.count(endpoint)) service->min_interval_ns = 1e9 / rates[endpoint];
+
     poller->registerSocket(sub_sock);
-    sub2pub[sub_sock] = pub_sock;
+    sub2service[sub_sock] = service;
   }
 
+  std::vector<char> frame;
+  BridgeFrameDecoder decoder;
+  std::vector<SubSocket*> ready;
+  uint64_t batch_ns = batch_ms * 1e6;
+
+  auto flush = [&](Service *service) {
+    service->encoder.finish(frame);
+    service->pub->send(frame.data(), frame.size());
+  };
+
+  auto forward = [&](Service *service, char *data, size_t size, uint64_t t) {
+    if (!service->should_forward(t)) return;
+
+    if (!framed) {
+      service->pub->send(data, size);
+      return;
+    }
+
+    if (service->encoder.num_msgs() == 0) service->batch_start_ns = t;
+    service->encoder.add(data, size);
+    if (batch_ns == 0 || service->encoder.raw_size() >= batch_bytes) {
+      flush(service);
+    }
+  };
+
   while (true) {
-    for (auto sub_sock : poller->poll(100)) {
-      Message * msg = sub_sock->receive();
-      if (msg == NULL) continue;
-      sub2pub[sub_sock]->sendMessage(msg);
-      delete msg;
+    poller->poll(batch_ns > 0 ? std::max(1, (int)batch_ms) : 100, ready);
+
+    uint64_t t = nanos_since_epoch();
+    for (auto sub_sock : ready) {
+      Service *service = sub2service[sub_sock];
+
+      // Drain the socket, so a burst ends up in a single frame
+      while (Message *msg = sub_sock->receive(true)) {
+        if (is_bridge_frame(msg->getData(), msg->getSize())) {
+          if (!decoder.decode(msg->getData(), msg->getSize(), [&](char *data, size_t size) { forward(service, data, size, t); })) {
+            std::cout << "dropping corrupt frame on " << service->name << std::endl;
+          }
+        } else {
+          forward(service, msg->getData(), msg->getSize(), t);
+        }
+        delete msg;
+      }
+    }
+
+    if (batch_ns > 0) {
+      for (auto &[sub_sock, service] : sub2service) {
+        if (service->encoder.num_msgs() > 0 && t - service->batch_start_ns >= batch_ns) {
+          flush(service);
+        }
+      }
     }
   }
   return 0;
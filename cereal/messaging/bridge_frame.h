@@ -0,0 +1,210 @@
+#pragma once
+
+// Frames carry a batch of messages of one service from the msgq -> zmq bridge to the
+// zmq -> msgq bridge, optionally compressed. A frame is a BridgeFrameHeader followed by
+// the messages, each prefixed with its uint32_t size.
+//
+// The magic would be a segment count of over a billion as the first word of a capnp
+// message, so plain messages from a bridge that doesn't batch are told apart by it.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef BRIDGE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef BRIDGE_LZ4
+#include <lz4.h>
+#endif
+
+#define BRIDGE_FRAME_MAGIC 0x47524442  // "BDRG"
+#define BRIDGE_FRAME_MAX_SIZE (64 * 1024 * 1024)
+
+enum class BridgeCodec : uint8_t {
+  NONE = 0,
+  ZSTD = 1,
+  LZ4 = 2,
+};
+
+struct BridgeFrameHeader {
+  uint32_t magic;
+  uint8_t codec;
+  uint8_t reserved[3];
+  uint32_t num_msgs;
+  uint32_t raw_size;  // size of the messages before compression
+};
+
+inline bool bridge_codec_supported(BridgeCodec codec) {
+  switch (codec) {
+    case BridgeCodec::NONE: return true;
+#ifdef BRIDGE_ZSTD
+    case BridgeCodec::ZSTD: return true;
+#endif
+#ifdef BRIDGE_LZ4
+    case BridgeCodec::LZ4: return true;
+#endif
+    default: return false;
+  }
+}
+
+inline bool bridge_codec_from_string(const std::string &name, BridgeCodec &codec) {
+  if (name == "none") codec = BridgeCodec::NONE;
+  else if (name == "zstd") codec = BridgeCodec::ZSTD;
+  else if (name == "lz4") codec = BridgeCodec::LZ4;
+  else return false;
+  return true;
+}
+
+inline bool is_bridge_frame(const char *data, size_t size) {
+  uint32_t magic;
+  if (size < sizeof(BridgeFrameHeader)) return false;
+  memcpy(&magic, data, sizeof(magic));
+  return magic == BRIDGE_FRAME_MAGIC;
+}
+
+class BridgeFrameEncoder {
+public:
+  BridgeFrameEncoder(BridgeCodec codec = BridgeCodec::NONE) : codec_(codec) {
+#ifdef BRIDGE_ZSTD
+    if (codec_ == BridgeCodec::ZSTD) zstd_ = ZSTD_createCCtx();
+#endif
+  }
+  BridgeFrameEncoder(const BridgeFrameEncoder &) = delete;
+  BridgeFrameEncoder &operator=(const BridgeFrameEncoder &) = delete;
+  ~BridgeFrameEncoder() {
+#ifdef BRIDGE_ZSTD
+    ZSTD_freeCCtx(zstd_);
+#endif
+  }
+
+  void add(const char *data, size_t size) {
+    uint32_t size32 = size;
+    size_t offset = raw_.size();
+    raw_.resize(offset + sizeof(size32) + size);
+    memcpy(&raw_[offset], &size32, sizeof(size32));
+    memcpy(&raw_[offset + sizeof(size32)], data, size);
+    num_msgs_++;
+  }
+
+  size_t num_msgs() const { return num_msgs_; }
+  size_t raw_size() const { return raw_.size(); }
+
+  // Encodes the pending messages into out and clears them
+  void finish(std::vector<char> &out) {
+    BridgeFrameHeader header = {BRIDGE_FRAME_MAGIC, (uint8_t)codec_, {}, num_msgs_, (uint32_t)raw_.size()};
+    out.resize(sizeof(header));
+
+    size_t compressed_size = 0;
+#ifdef BRIDGE_ZSTD
+    if (codec_ == BridgeCodec::ZSTD) {
+      out.resize(sizeof(header) + ZSTD_compressBound(raw_.size()));
+      compressed_size = ZSTD_compressCCtx(zstd_, &out[sizeof(header)], out.size() - sizeof(header), raw_.data(), raw_.size(), 1);
+      if (ZSTD_isError(compressed_size)) compressed_size = 0;
+    }
+#endif
+#ifdef BRIDGE_LZ4
+    if (codec_ == BridgeCodec::LZ4) {
+      out.resize(sizeof(header) + LZ4_compressBound(raw_.size()));
+      compressed_size = LZ4_compress_default(raw_.data(), &out[sizeof(header)], raw_.size(), out.size() - sizeof(header));
+    }
+#endif
+
+    // Send uncompressed when compression failed or isn't compiled in
+    if (compressed_size == 0) {
+      header.codec = (uint8_t)BridgeCodec::NONE;
+      out.resize(sizeof(header));
+      out.insert(out.end(), raw_.begin(), raw_.end());
+    } else {
+      out.resize(sizeof(header) + compressed_size);
+    }
+    memcpy(out.data(), &header, sizeof(header));
+
+    raw_.clear();
+    num_msgs_ = 0;
+  }
+
+private:
+  BridgeCodec codec_;
+  std::vector<char> raw_;
+  uint32_t num_msgs_ = 0;
+#ifdef BRIDGE_ZSTD
+  ZSTD_CCtx *zstd_ = nullptr;
+#endif
+};
+
+class BridgeFrameDecoder {
+public:
+  BridgeFrameDecoder() {
+#ifdef BRIDGE_ZSTD
+    zstd_ = ZSTD_createDCtx();
+#endif
+  }
+  BridgeFrameDecoder(const BridgeFrameDecoder &) = delete;
+  BridgeFrameDecoder &operator=(const BridgeFrameDecoder &) = delete;
+  ~BridgeFrameDecoder() {
+#ifdef BRIDGE_ZSTD
+    ZSTD_freeDCtx(zstd_);
+#endif
+  }
+
+  // Calls f(data, size) for every message in the frame. Returns false if the frame is
+  // corrupt or uses a codec that isn't compiled in, messages before the error are still passed to f.
+  template <typename F>
+  bool decode(const char *data, size_t size, F f) {
+    if (!is_bridge_frame(data, size)) return false;
+
+    BridgeFrameHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.raw_size > BRIDGE_FRAME_MAX_SIZE) return false;
+
+    const char *payload = data + sizeof(header);
+    size_t payload_size = size - sizeof(header);
+    switch ((BridgeCodec)header.codec) {
+      case BridgeCodec::NONE:
+        break;
+#ifdef BRIDGE_ZSTD
+      case BridgeCodec::ZSTD: {
+        buf_.resize(header.raw_size);
+        size_t ret = ZSTD_decompressDCtx(zstd_, buf_.data(), buf_.size(), payload, payload_size);
+        if (ZSTD_isError(ret) || ret != header.raw_size) return false;
+        payload = buf_.data();
+        payload_size = ret;
+        break;
+      }
+#endif
+#ifdef BRIDGE_LZ4
+      case BridgeCodec::LZ4: {
+        buf_.resize(header.raw_size);
+        int ret = LZ4_decompress_safe(payload, buf_.data(), payload_size, buf_.size());
+        if (ret < 0 || (uint32_t)ret != header.raw_size) return false;
+        payload = buf_.data();
+        payload_size = ret;
+        break;
+      }
+#endif
+      default:
+        return false;
+    }
+
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header.num_msgs; i++) {
+      uint32_t msg_size;
+      if (payload_size - offset < sizeof(msg_size)) return false;
+      memcpy(&msg_size, payload + offset, sizeof(msg_size));
+      offset += sizeof(msg_size);
+      if (payload_size - offset < msg_size) return false;
+
+      f((char *)payload + offset, (size_t)msg_size);
+      offset += msg_size;
+    }
+    return offset == payload_size;
+  }
+
+private:
+  std::vector<char> buf_;
+#ifdef BRIDGE_ZSTD
+  ZSTD_DCtx *zstd_ = nullptr;
+#endif
+};
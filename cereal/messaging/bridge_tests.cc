@@ -0,0 +1,78 @@
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "bridge_frame.h"
+
+static std::vector<std::string> decode(BridgeFrameDecoder &decoder, const std::vector<char> &frame, bool *ok = nullptr) {
+  std::vector<std::string> msgs;
+  bool ret = decoder.decode(frame.data(), frame.size(), [&](char *data, size_t size) {
+    msgs.emplace_back(data, size);
+  });
+  if (ok) *ok = ret;
+  return msgs;
+}
+
+TEST_CASE("Bridge frame roundtrip"){
+  BridgeCodec codec = GENERATE(BridgeCodec::NONE, BridgeCodec::ZSTD, BridgeCodec::LZ4);
+  BridgeFrameEncoder encoder(codec);
+  BridgeFrameDecoder decoder;
+
+  std::vector<std::string> msgs = {"", "a", std::string(1000, 'x'), "hello world"};
+  for (auto &m : msgs) {
+    encoder.add(m.data(), m.size());
+  }
+  REQUIRE(encoder.num_msgs() == msgs.size());
+
+  std::vector<char> frame;
+  encoder.finish(frame);
+  REQUIRE(encoder.num_msgs() == 0);
+  REQUIRE(encoder.raw_size() == 0);
+  REQUIRE(is_bridge_frame(frame.data(), frame.size()));
+
+  // Falls back to no compression when the codec isn't compiled in
+  BridgeFrameHeader header;
+  memcpy(&header, frame.data(), sizeof(header));
+  REQUIRE(header.codec == (uint8_t)(bridge_codec_supported(codec) ? codec : BridgeCodec::NONE));
+
+  bool ok;
+  REQUIRE(decode(decoder, frame, &ok) == msgs);
+  REQUIRE(ok);
+
+  // The encoder can be reused after finish
+  encoder.add("b", 1);
+  encoder.finish(frame);
+  REQUIRE(decode(decoder, frame) == std::vector<std::string>{"b"});
+}
+
+TEST_CASE("Bridge frame rejects corrupt frames"){
+  BridgeFrameEncoder encoder;
+  BridgeFrameDecoder decoder;
+  encoder.add("hello", 5);
+  encoder.add("world", 5);
+
+  std::vector<char> frame;
+  encoder.finish(frame);
+
+  SECTION("Truncated"){
+    frame.resize(frame.size() - 1);
+    bool ok;
+    REQUIRE(decode(decoder, frame, &ok) == std::vector<std::string>{"hello"});
+    REQUIRE(!ok);
+  }
+  SECTION("Unknown codec"){
+    frame[offsetof(BridgeFrameHeader, codec)] = 42;
+    bool ok;
+    REQUIRE(decode(decoder, frame, &ok).empty());
+    REQUIRE(!ok);
+  }
+  SECTION("Not a frame"){
+    // First word of a capnp message with a single segment
+    std::vector<char> msg(16, 0);
+    REQUIRE(!is_bridge_frame(msg.data(), msg.size()));
+    bool ok;
+    REQUIRE(decode(decoder, msg, &ok).empty());
+    REQUIRE(!ok);
+  }
+}
@@ -16,23 +16,36 @@ void sig_handler(int signal) {
   msgq_do_exit = 1;
 }
 
-static bool service_exists(std::string path){
+static const struct service *get_service(std::string endpoint){
   for (const auto& it : services) {
-    if (it.name == path) {
-      return true;
+    if (it.name == endpoint) {
+      return &it;
     }
   }
-  return false;
+  return NULL;
+}
+
+static bool service_exists(std::string path){
+  return get_service(path) != NULL;
 }
 
+// Buffer size, reader slots and queue mode come from services.py, other endpoints get the defaults
 static size_t get_size(std::string endpoint){
-  size_t sz = DEFAULT_SEGMENT_SIZE;
+  const struct service *serv = get_service(endpoint);
+  return serv ? serv->buffer_size : DEFAULT_SEGMENT_SIZE;
+}
 
-  if (endpoint == "roadCameraState" || endpoint == "driverCameraState" || endpoint == "wideRoadCameraState"){
-    sz *= 10;
-  }
+static size_t get_num_readers(std::string endpoint){
+  const struct service *serv = get_service(endpoint);
+  return serv ? serv->num_readers : DEFAULT_NUM_READERS;
+}
 
-  return sz;
+static uint64_t get_flags(std::string endpoint){
+  const struct service *serv = get_service(endpoint);
+  if (serv == NULL){
+    return 0;
+  }
+  return (serv->multiple_publishers ? MSGQ_FLAGS_MULTIPLE_PUBLISHERS : 0) | (serv->latest_value ? MSGQ_FLAGS_LATEST_VALUE : 0);
 }
 
 
@@ -78,12 +91,15 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint), get_flags(endpoint));
   if (r != 0){
     return r;
   }
 
-  msgq_init_subscriber(q);
+  r = msgq_init_subscriber(q);
+  if (r != 0){
+    return r;
+  }
 
   if (conflate){
     q->read_conflate = true;
@@ -151,10 +167,53 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   return (Message*)r;
 }
 
+bool MSGQSubSocket::receive_borrowed(char **data, size_t *size){
+  msgq_msg_t msg;
+  if (msgq_msg_borrow(&msg, q) <= 0){
+    return false;
+  }
+
+  *data = msg.data;
+  *size = msg.size;
+  return true;
+}
+
+bool MSGQSubSocket::release_borrowed(){
+  return msgq_msg_release(q) == 0;
+}
+
+size_t MSGQSubSocket::receive_batch(MessageBatch &batch, size_t max_msgs, size_t max_bytes){
+  batch.clear();
+
+  if (batch_msgs.size() < max_msgs){
+    batch_msgs.resize(max_msgs);
+  }
+
+  int n = msgq_msg_borrow_batch(batch_msgs.data(), max_msgs, max_bytes, q);
+  if (n <= 0){
+    return 0;
+  }
+
+  for (int i = 0; i < n; i++){
+    memcpy(batch.append(batch_msgs[i].size), batch_msgs[i].data, batch_msgs[i].size);
+  }
+
+  // One validity check for the whole batch
+  if (msgq_msg_release(q) != 0){
+    batch.clear();
+  }
+
+  return batch.size();
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
 
+int MSGQSubSocket::fd(){
+  return msgq_get_fd(q);
+}
+
 MSGQSubSocket::~MSGQSubSocket(){
   if (q != NULL){
     msgq_close_queue(q);
@@ -170,7 +229,7 @@ int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_en
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint), get_flags(endpoint));
   if (r != 0){
     return r;
   }
@@ -196,6 +255,14 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+char * MSGQPubSocket::reserve(size_t size){
+  return msgq_msg_reserve(q, size);
+}
+
+int MSGQPubSocket::commit(){
+  return msgq_msg_commit(q);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
@@ -218,13 +285,28 @@ void MSGQPoller::registerSocket(SubSocket * socket){
 
 std::vector<SubSocket*> MSGQPoller::poll(int timeout){
   std::vector<SubSocket*> r;
+  poll(timeout, r);
+  return r;
+}
+
+void MSGQPoller::poll(int timeout, std::vector<SubSocket*> &ready){
+  ready.clear();
 
   msgq_poll(polls, num_polls, timeout);
   for (size_t i = 0; i < num_polls; i++){
     if (polls[i].revents){
-      r.push_back(sockets[i]);
+      ready.push_back(sockets[i]);
     }
   }
+}
 
-  return r;
+void MSGQPoller::poll_indices(int timeout, std::vector<size_t> &ready){
+  ready.clear();
+
+  msgq_poll(polls, num_polls, timeout);
+  for (size_t i = 0; i < num_polls; i++){
+    if (polls[i].revents){
+      ready.push_back(i);
+    }
+  }
 }
@@ -33,11 +33,16 @@ class MSGQSubSocket : public SubSocket {
 private:
   msgq_queue_t * q = NULL;
   int timeout;
+  std::vector<msgq_msg_t> batch_msgs;
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
   Message *receive(bool non_blocking=false);
+  bool receive_borrowed(char **data, size_t *size);
+  bool release_borrowed();
+  size_t receive_batch(MessageBatch &batch, size_t max_msgs, size_t max_bytes);
+  int fd();
   ~MSGQSubSocket();
 };
 
@@ -48,6 +53,8 @@ public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  char *reserve(size_t size);
+  int commit();
   bool all_readers_updated();
   ~MSGQPubSocket();
 };
@@ -61,5 +68,7 @@ private:
 public:
   void registerSocket(SubSocket *socket);
   std::vector<SubSocket*> poll(int timeout);
+  void poll(int timeout, std::vector<SubSocket*> &ready);
+  void poll_indices(int timeout, std::vector<size_t> &ready);
   ~MSGQPoller(){};
 };
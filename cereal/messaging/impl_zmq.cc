@@ -99,10 +99,51 @@ Message * ZMQSubSocket::receive(bool non_blocking){
   return r;
 }
 
+bool ZMQSubSocket::receive_borrowed(char **data, size_t *size){
+  assert(zmq_msg_init(&borrowed_msg) == 0);
+
+  if (zmq_msg_recv(&borrowed_msg, sock, ZMQ_DONTWAIT) < 0){
+    zmq_msg_close(&borrowed_msg);
+    return false;
+  }
+
+  *data = (char*)zmq_msg_data(&borrowed_msg);
+  *size = zmq_msg_size(&borrowed_msg);
+  return true;
+}
+
+bool ZMQSubSocket::release_borrowed(){
+  // The message is owned by us until closed, so it can't be overwritten
+  zmq_msg_close(&borrowed_msg);
+  return true;
+}
+
+size_t ZMQSubSocket::receive_batch(MessageBatch &batch, size_t max_msgs, size_t max_bytes){
+  batch.clear();
+
+  size_t bytes = 0;
+  char *data;
+  size_t size;
+  while (batch.size() < max_msgs && bytes < max_bytes && receive_borrowed(&data, &size)){
+    memcpy(batch.append(size), data, size);
+    bytes += size;
+    release_borrowed();
+  }
+
+  return batch.size();
+}
+
 void ZMQSubSocket::setTimeout(int timeout){
   zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(int));
 }
 
+int ZMQSubSocket::fd(){
+  int fd = -1;
+  size_t fd_size = sizeof(fd);
+  zmq_getsockopt(sock, ZMQ_FD, &fd, &fd_size);
+  return fd;
+}
+
 ZMQSubSocket::~ZMQSubSocket(){
   zmq_close(sock);
 }
@@ -131,6 +172,21 @@ int ZMQPubSocket::send(char *data, size_t size){
   return zmq_send(sock, data, size, ZMQ_DONTWAIT);
 }
 
+char * ZMQPubSocket::reserve(size_t size){
+  if (zmq_msg_init_size(&reserved_msg, size) != 0){
+    return NULL;
+  }
+  return (char*)zmq_msg_data(&reserved_msg);
+}
+
+int ZMQPubSocket::commit(){
+  int rc = zmq_msg_send(&reserved_msg, sock, ZMQ_DONTWAIT);
+  if (rc < 0){
+    zmq_msg_close(&reserved_msg);
+  }
+  return rc;
+}
+
 bool ZMQPubSocket::all_readers_updated() {
   assert(false); // TODO not implemented
   return false;
@@ -152,17 +208,36 @@ void ZMQPoller::registerSocket(SubSocket * socket){
 
 std::vector<SubSocket*> ZMQPoller::poll(int timeout){
   std::vector<SubSocket*> r;
+  poll(timeout, r);
+  return r;
+}
+
+void ZMQPoller::poll(int timeout, std::vector<SubSocket*> &ready){
+  ready.clear();
 
   int rc = zmq_poll(polls, num_polls, timeout);
   if (rc < 0){
-    return r;
+    return;
   }
 
   for (size_t i = 0; i < num_polls; i++){
     if (polls[i].revents){
-      r.push_back(sockets[i]);
+      ready.push_back(sockets[i]);
     }
   }
+}
 
-  return r;
+void ZMQPoller::poll_indices(int timeout, std::vector<size_t> &ready){
+  ready.clear();
+
+  int rc = zmq_poll(polls, num_polls, timeout);
+  if (rc < 0){
+    return;
+  }
+
+  for (size_t i = 0; i < num_polls; i++){
+    if (polls[i].revents){
+      ready.push_back(i);
+    }
+  }
 }
@@ -31,11 +31,16 @@ class ZMQSubSocket : public SubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  zmq_msg_t borrowed_msg;
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return sock;}
   Message *receive(bool non_blocking=false);
+  bool receive_borrowed(char **data, size_t *size);
+  bool release_borrowed();
+  size_t receive_batch(MessageBatch &batch, size_t max_msgs, size_t max_bytes);
+  int fd();
   ~ZMQSubSocket();
 };
 
@@ -43,10 +48,13 @@ class ZMQPubSocket : public PubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  zmq_msg_t reserved_msg;
 public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  char *reserve(size_t size);
+  int commit();
   bool all_readers_updated();
   ~ZMQPubSocket();
 };
@@ -60,5 +68,7 @@ private:
 public:
   void registerSocket(SubSocket *socket);
   std::vector<SubSocket*> poll(int timeout);
+  void poll(int timeout, std::vector<SubSocket*> &ready);
+  void poll_indices(int timeout, std::vector<size_t> &ready);
   ~ZMQPoller(){};
 };
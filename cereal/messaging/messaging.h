@@ -1,10 +1,17 @@
 #pragma once
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <cstring>
 #include <map>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <capnp/serialize.h>
 #include "../gen/cpp/log.capnp.h"
+#include "../services.h"
+#include "sim_clock.h"
 
 #ifdef __APPLE__
 #define CLOCK_BOOTTIME CLOCK_MONOTONIC
@@ -31,12 +38,47 @@ public:
   virtual ~Message(){};
 };
 
+// Messages received in one call, stored back to back and word aligned in a reusable buffer
+class MessageBatch {
+public:
+  void clear() { msgs_.clear(); words_ = 0; }
+  size_t size() const { return msgs_.size(); }
+  char *getData(size_t i) { return (char *)(buf_.data() + msgs_[i].first); }
+  size_t getSize(size_t i) const { return msgs_[i].second; }
+  kj::ArrayPtr<const capnp::word> getWords(size_t i) const {
+    return kj::arrayPtr((const capnp::word *)(buf_.data() + msgs_[i].first), (msgs_[i].second + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  }
+
+  // Adds a message and returns where to copy it to
+  char *append(size_t size) {
+    size_t offset = words_;
+    words_ += (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    if (buf_.size() < words_) buf_.resize(std::max(words_, 2 * buf_.size()));
+    msgs_.push_back({offset, size});
+    return (char *)(buf_.data() + offset);
+  }
+
+private:
+  std::vector<uint64_t> buf_;
+  size_t words_ = 0;
+  std::vector<std::pair<size_t, size_t>> msgs_;  // offset in words, size in bytes
+};
 
 class SubSocket {
 public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  // Non-blocking zero-copy receive. data points at the message in place and is only valid
+  // until release_borrowed(), which returns false if it was overwritten in the meantime.
+  virtual bool receive_borrowed(char **data, size_t *size) = 0;
+  virtual bool release_borrowed() = 0;
+  // Non-blocking, replaces the contents of batch with up to max_msgs messages and
+  // about max_bytes of data. Returns the number of messages received.
+  virtual size_t receive_batch(MessageBatch &batch, size_t max_msgs, size_t max_bytes) = 0;
+  // File descriptor for epoll or an event loop, or -1 on failure. When it becomes
+  // readable, receive non-blocking until there are no messages left.
+  virtual int fd() = 0;
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
@@ -48,6 +90,9 @@ public:
   virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true) = 0;
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
+  // Zero-copy send: serialize size bytes into the buffer returned by reserve(), then publish it with commit()
+  virtual char *reserve(size_t size) = 0;
+  virtual int commit() = 0;
   virtual bool all_readers_updated() = 0;
   static PubSocket * create();
   static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
@@ -59,11 +104,36 @@ class Poller {
 public:
   virtual void registerSocket(SubSocket *socket) = 0;
   virtual std::vector<SubSocket*> poll(int timeout) = 0;
+  // Fills ready with the sockets that have messages, reusing its storage so polling doesn't allocate
+  virtual void poll(int timeout, std::vector<SubSocket*> &ready) = 0;
+  // Same, but fills ready with the positions of the sockets in registration order
+  virtual void poll_indices(int timeout, std::vector<size_t> &ready) = 0;
   static Poller * create();
   static Poller * create(std::vector<SubSocket*> sockets);
   virtual ~Poller(){};
 };
 
+// Index of the service in services[], or -1 if there is no such service. It is only guaranteed to be
+// evaluated at compile time in a constant expression, the name overloads of SubMaster and PubMaster
+// look the service up on every call. Use ServiceId::name in loops.
+constexpr int get_service_index(const char *name) {
+  for (int i = 0; i < NUM_SERVICES; i++) {
+    const char *a = services[i].name, *b = name;
+    while (*a != '\0' && *a == *b) {
+      a++;
+      b++;
+    }
+    if (*a == *b) return i;
+  }
+  return -1;
+}
+
+constexpr ServiceId get_service_id(const char *name) {
+  int idx = get_service_index(name);
+  if (idx < 0) throw std::out_of_range(name);
+  return (ServiceId)idx;
+}
+
 class SubMaster {
 public:
   SubMaster(const std::vector<const char *> &service_list,
@@ -77,30 +147,49 @@ public:
   ~SubMaster();
 
   uint64_t frame = 0;
-  bool updated(const char *name) const;
-  bool alive(const char *name) const;
-  bool valid(const char *name) const;
-  uint64_t rcv_frame(const char *name) const;
-  uint64_t rcv_time(const char *name) const;
-  cereal::Event::Reader &operator[](const char *name) const;
+  bool updated(ServiceId id) const;
+  bool alive(ServiceId id) const;
+  bool valid(ServiceId id) const;
+  uint64_t rcv_frame(ServiceId id) const;
+  uint64_t rcv_time(ServiceId id) const;
+  cereal::Event::Reader &operator[](ServiceId id) const;
+
+  inline bool updated(const char *name) const { return updated(get_service_id(name)); }
+  inline bool alive(const char *name) const { return alive(get_service_id(name)); }
+  inline bool valid(const char *name) const { return valid(get_service_id(name)); }
+  inline uint64_t rcv_frame(const char *name) const { return rcv_frame(get_service_id(name)); }
+  inline uint64_t rcv_time(const char *name) const { return rcv_time(get_service_id(name)); }
+  inline cereal::Event::Reader &operator[](const char *name) const { return (*this)[get_service_id(name)]; }
 
 private:
+  struct SubMessage;
+  SubMessage *get(ServiceId id) const;
+  void update_alive(uint64_t current_time);
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
   Poller *poller_ = nullptr;
-  struct SubMessage;
-  std::map<SubSocket *, SubMessage *> messages_;
-  std::map<std::string, SubMessage *> services_;
+  // Positions in messages_, which is in the order the sockets were registered with the poller
+  std::vector<size_t> ready_;
+  std::vector<SubMessage *> messages_;
+  // Indexed by ServiceId, null for services that are not subscribed to
+  std::array<SubMessage *, NUM_SERVICES> services_ = {};
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // Builds in first_segment until it is full, it has to be zeroed and outlive the builder
+  MessageBuilder(kj::ArrayPtr<capnp::word> first_segment) : capnp::MallocMessageBuilder(first_segment) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
-    struct timespec t;
-    clock_gettime(CLOCK_BOOTTIME, &t);
-    uint64_t current_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
+    uint64_t current_time;
+    if (sim_clock_t *c = sim_clock()) {
+      current_time = c->nanos;
+    } else {
+      struct timespec t;
+      clock_gettime(CLOCK_BOOTTIME, &t);
+      current_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
+    }
     event.setLogMonoTime(current_time);
     event.setValid(valid);
     return event;
@@ -115,15 +204,51 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// Keeps the first segment of a MessageBuilder between messages, so a publisher doesn't
+// allocate and free it for every message. reset() invalidates the previous message.
+//
+//   ReusableMessageBuilder builder;
+//   while (true) {
+//     MessageBuilder &msg = builder.reset();
+//     msg.initEvent().initCan(...);
+//     pm.send("can", msg);
+//   }
+class ReusableMessageBuilder {
+public:
+  ReusableMessageBuilder(size_t size_words = 8 * 1024) : segment_(kj::heapArray<capnp::word>(size_words)) {
+    memset(segment_.begin(), 0, segment_.asBytes().size());
+  }
+
+  MessageBuilder &reset() {
+    if (builder_) {
+      // capnp needs a zeroed segment, only clear the part the last message used
+      auto segments = builder_->getSegmentsForOutput();
+      if (segments.size() > 0) {
+        memset(segment_.begin(), 0, segments[0].asBytes().size());
+      }
+      builder_.reset();
+    }
+    return builder_.emplace(segment_.asPtr());
+  }
+
+private:
+  kj::Array<capnp::word> segment_;
+  std::optional<MessageBuilder> builder_;
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
-  inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
-  int send(const char *name, MessageBuilder &msg);
+  inline int send(ServiceId id, capnp::byte *data, size_t size) { return get(id)->send((char *)data, size); }
+  int send(ServiceId id, MessageBuilder &msg);
+  inline int send(const char *name, capnp::byte *data, size_t size) { return send(get_service_id(name), data, size); }
+  inline int send(const char *name, MessageBuilder &msg) { return send(get_service_id(name), msg); }
   ~PubMaster();
 
 private:
-  std::map<std::string, PubSocket *> sockets_;
+  PubSocket *get(ServiceId id) const;
+  // Indexed by ServiceId, null for services that are not published
+  std::array<PubSocket *, NUM_SERVICES> sockets_ = {};
 };
 
 class AlignedBuffer {
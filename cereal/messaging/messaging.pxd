@@ -18,11 +18,17 @@ cdef extern from "messaging.h":
     size_t getSize()
     char *getData()
 
+  cdef cppclass MessageBatch:
+    size_t size()
+    char *getData(size_t)
+    size_t getSize(size_t)
+
   cdef cppclass SubSocket:
     @staticmethod
     SubSocket * create()
     int connect(Context *, string, string, bool)
     Message * receive(bool)
+    size_t receive_batch(MessageBatch &, size_t, size_t)
     void setTimeout(int)
 
   cdef cppclass PubSocket:
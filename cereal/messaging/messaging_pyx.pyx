@@ -12,6 +12,7 @@ from .messaging cimport SubSocket as cppSubSocket
 from .messaging cimport PubSocket as cppPubSocket
 from .messaging cimport Poller as cppPoller
 from .messaging cimport Message as cppMessage
+from .messaging cimport MessageBatch as cppMessageBatch
 
 
 class MessagingError(Exception):
@@ -71,6 +72,7 @@ cdef class Poller:
 cdef class SubSocket:
   cdef cppSubSocket * socket
   cdef bool is_owner
+  cdef cppMessageBatch batch
 
   def __cinit__(self):
     self.socket = cppSubSocket.create()
@@ -119,6 +121,10 @@ cdef class SubSocket:
 
       return m
 
+  def receive_batch(self, size_t max_msgs=1000, size_t max_bytes=10*1024*1024):
+    n = self.socket.receive_batch(self.batch, max_msgs, max_bytes)
+    return [self.batch.getData(i)[:self.batch.getSize(i)] for i in range(n)]
+
 
 cdef class PubSocket:
   cdef cppPubSocket * socket
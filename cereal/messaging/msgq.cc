@@ -9,8 +9,14 @@
 #include <cstdlib>
 #include <csignal>
 #include <random>
+#include <thread>
 
 #include <poll.h>
+#include <sched.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#endif
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -22,22 +28,237 @@
 #include <stdio.h>
 
 #include "msgq.h"
+#include "sim_clock.h"
 
-void sigusr2_handler(int signal) {
-  assert(signal == SIGUSR2);
+static msgq_notify_t *msgq_map_notify_table(void){
+  auto fd = open("/dev/shm/msgq_notify", O_RDWR | O_CREAT, 0666);
+  if (fd < 0) {
+    std::cout << "Warning, could not open notify table" << std::endl;
+    return NULL;
+  }
+
+  size_t size = NUM_NOTIFY_SLOTS * sizeof(msgq_notify_t);
+  int rc = ftruncate(fd, size);
+  if (rc < 0){
+    close(fd);
+    return NULL;
+  }
+
+  void * mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  return (mem == MAP_FAILED) ? NULL : (msgq_notify_t *)mem;
 }
 
-uint64_t msgq_get_uid(void){
-  std::random_device rd("/dev/urandom");
-  std::uniform_int_distribution<uint64_t> distribution(0,std::numeric_limits<uint32_t>::max());
+static msgq_notify_t *msgq_notify_table(void){
+  static msgq_notify_t *table = msgq_map_notify_table();
+  return table;
+}
 
+static uint32_t msgq_notify_slot(void){
   #ifdef __APPLE__
-    // TODO: this doesn't work
-    uint64_t uid = distribution(rd) << 32 | getpid();
+    static thread_local uint32_t slot = getpid() % NUM_NOTIFY_SLOTS;
   #else
-    uint64_t uid = distribution(rd) << 32 | syscall(SYS_gettid);
+    static thread_local uint32_t slot = syscall(SYS_gettid) % NUM_NOTIFY_SLOTS;
   #endif
 
+  return slot;
+}
+
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t val, int ms){
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000 * 1000;
+
+  #ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+  #else
+    // No futex, fall back to sleeping until the timeout
+    if (*addr == val) nanosleep(&ts, NULL);
+  #endif
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr){
+  #ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+  #endif
+}
+
+static void msgq_notify(uint64_t slot){
+  msgq_notify_t *n = &msgq_notify_table()[slot % NUM_NOTIFY_SLOTS];
+  std::atomic<uint32_t> *seq = reinterpret_cast<std::atomic<uint32_t>*>(&n->seq);
+  std::atomic<uint32_t> *waiters = reinterpret_cast<std::atomic<uint32_t>*>(&n->waiters);
+
+  seq->fetch_add(1);
+
+  // Skip the syscall if nobody is sleeping on this slot
+  if (*waiters > 0){
+    futex_wake(seq);
+  }
+}
+
+// Pollers of a latest value queue aren't tracked, instead they set the bit of their notify slot before every
+// wait. The publisher wakes the slots that are set and clears their bits, so bits of pollers that are gone don't stay around.
+static void msgq_latest_register(msgq_queue_t *q, uint32_t slot){
+  std::atomic<uint64_t> *mask = reinterpret_cast<std::atomic<uint64_t>*>(&q->latest->wake_mask[slot / 64]);
+  uint64_t bit = 1ULL << (slot % 64);
+  if (!(*mask & bit)){
+    mask->fetch_or(bit);
+  }
+}
+
+static std::atomic<uint64_t> *msgq_latest_subscriber(msgq_queue_t *q, int id){
+  return reinterpret_cast<std::atomic<uint64_t>*>(&q->latest->subscribers[id]);
+}
+
+static int msgq_latest_claim_subscriber(msgq_queue_t *q, uint64_t uid){
+  for (int i = 0; i < MSGQ_LATEST_MAX_SUBSCRIBERS; i++){
+    uint64_t free_uid = 0;
+    if (*msgq_latest_subscriber(q, i) == 0 && std::atomic_compare_exchange_strong(msgq_latest_subscriber(q, i), &free_uid, uid)){
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Counts this reader as up to date if message n is still the newest one
+static void msgq_latest_count_read(msgq_queue_t *q, uint64_t n){
+  // The publisher doesn't wait for subscribers without a slot
+  if (q->latest_subscriber_id < 0){
+    return;
+  }
+
+  std::atomic<uint64_t> *read_count = reinterpret_cast<std::atomic<uint64_t>*>(&q->latest->read_count);
+  uint64_t count = *read_count;
+  while ((count & ~0xFFFFULL) == MSGQ_LATEST_READ_COUNT(n) && !std::atomic_compare_exchange_weak(read_count, &count, count + 1)){
+    ;
+  }
+}
+
+// The publisher can only wake a futex. To make a reader pollable, a thread waits
+// on the futex for it and makes a file descriptor readable when the queue moves.
+struct msgq_fd_bridge_t {
+  int read_fd;
+  int write_fd;
+  std::atomic<bool> exit;
+  std::atomic<int64_t> slot;
+  std::thread thread;
+};
+
+// The thread only touches the shared queue memory. The subscriber points its reader slot at the
+// notify slot of the thread, also when it reconnects to a different reader slot.
+static void msgq_fd_bridge_thread(msgq_queue_t *q, msgq_fd_bridge_t *bridge){
+  uint32_t slot = msgq_notify_slot();
+  msgq_notify_t *n = &msgq_notify_table()[slot];
+  std::atomic<uint32_t> *seq = reinterpret_cast<std::atomic<uint32_t>*>(&n->seq);
+  std::atomic<uint32_t> *waiters = reinterpret_cast<std::atomic<uint32_t>*>(&n->waiters);
+  bridge->slot = slot;
+
+  // Signal once at the start, there might be messages from before the bridge existed
+  uint64_t last_write_pointer = UINT64_MAX;
+
+  while (!bridge->exit){
+    if (q->latest_value){
+      msgq_latest_register(q, slot);
+    }
+
+    uint32_t cur_seq = *seq;
+    uint64_t write_pointer = *q->write_pointer;
+    if (write_pointer != last_write_pointer){
+      uint64_t one = 1;
+      if (write(bridge->write_fd, &one, sizeof(one)) < 0 && errno != EAGAIN){
+        std::cout << q->endpoint << ": Failed to signal fd" << std::endl;
+      }
+      last_write_pointer = write_pointer;
+    }
+
+    waiters->fetch_add(1);
+    futex_wait(seq, cur_seq, 100);
+    waiters->fetch_sub(1);
+  }
+}
+
+// Called before every receive, so a message written after the fd was cleared makes it readable again
+static void msgq_clear_fd(msgq_queue_t *q){
+  msgq_fd_bridge_t *bridge = q->fd_bridge;
+  if (bridge == NULL){
+    return;
+  }
+
+  // A single read resets an eventfd, a pipe has to be drained
+  uint64_t buf;
+  while (read(bridge->read_fd, &buf, sizeof(buf)) == sizeof(buf) && bridge->read_fd != bridge->write_fd){
+    ;
+  }
+}
+
+static void msgq_close_fd(msgq_queue_t *q){
+  msgq_fd_bridge_t *bridge = q->fd_bridge;
+  if (bridge == NULL){
+    return;
+  }
+
+  bridge->exit = true;
+  int64_t slot = bridge->slot;
+  if (slot >= 0){
+    msgq_notify(slot);
+  }
+  bridge->thread.join();
+
+  close(bridge->read_fd);
+  if (bridge->write_fd != bridge->read_fd){
+    close(bridge->write_fd);
+  }
+  delete bridge;
+  q->fd_bridge = NULL;
+}
+
+int msgq_get_fd(msgq_queue_t *q){
+  assert(q->read_uid_local != 0); // Make sure subscriber is initialized
+
+  if (q->fd_bridge == NULL){
+    int fds[2];
+#ifdef __linux__
+    fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0] < 0){
+      return -1;
+    }
+#else
+    if (pipe(fds) != 0){
+      return -1;
+    }
+    for (int fd : fds){
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    msgq_fd_bridge_t *bridge = new msgq_fd_bridge_t;
+    bridge->read_fd = fds[0];
+    bridge->write_fd = fds[1];
+    bridge->exit = false;
+    bridge->slot = -1;
+    bridge->thread = std::thread(msgq_fd_bridge_thread, q, bridge);
+    q->fd_bridge = bridge;
+
+    while (bridge->slot < 0){
+      std::this_thread::yield();
+    }
+    if (q->reader_id >= 0){
+      *q->read_notify[q->reader_id] = bridge->slot;
+    }
+  }
+
+  return q->fd_bridge->read_fd;
+}
+
+uint64_t msgq_get_uid(void){
+  std::random_device rd("/dev/urandom");
+  std::uniform_int_distribution<uint64_t> distribution(0,std::numeric_limits<uint32_t>::max());
+
+  // The lower half is used to check if the owner of a reader slot is still alive
+  uint64_t uid = distribution(rd) << 32 | getpid();
+
   return uid;
 }
 
@@ -82,62 +303,185 @@ void msgq_wait_for_subscriber(msgq_queue_t *q){
 }
 
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
+static char * msgq_map_queue(int fd, size_t len){
+  // Never shrink the file, other processes might have it mapped
+  struct stat st;
+  if (fstat(fd, &st) < 0){
+    return NULL;
+  }
+
+  if ((size_t)st.st_size < len && ftruncate(fd, len) < 0){
+    return NULL;
+  }
+
+  char * mem = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+// Queues left behind by a build with a different header layout can't be shared.
+// Unlink the file so a new one gets created, processes that still have the old one
+// mapped keep using it until they restart.
+static bool msgq_check_version(msgq_header_t *header, int fd, const char * full_path){
+  uint64_t version = 0;
+  std::atomic<uint64_t> *header_version = reinterpret_cast<std::atomic<uint64_t>*>(&header->version);
+  if (std::atomic_compare_exchange_strong(header_version, &version, (uint64_t)MSGQ_VERSION) || version == MSGQ_VERSION){
+    return true;
+  }
+
+  std::cout << "Warning, " << full_path << " has layout version " << version << " instead of " << MSGQ_VERSION << ", recreating" << std::endl;
+
+  // Only unlink if nobody else replaced the file in the meantime
+  struct stat st_fd, st_path;
+  if (fstat(fd, &st_fd) == 0 && stat(full_path, &st_path) == 0 &&
+      st_fd.st_dev == st_path.st_dev && st_fd.st_ino == st_path.st_ino){
+    unlink(full_path);
+  }
+  return false;
+}
+
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers, uint64_t flags){
   assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
-  std::signal(SIGUSR2, sigusr2_handler);
+  assert(max_readers > 0);
+  assert(!((flags & MSGQ_FLAGS_MULTIPLE_PUBLISHERS) && (flags & MSGQ_FLAGS_LATEST_VALUE)));
+  assert(!(flags & MSGQ_FLAGS_LATEST_VALUE) || size > sizeof(msgq_latest_t) + 2 * CACHE_LINE_SIZE);
+
+  q->fd_bridge = NULL;
+  q->sim_clock = sim_clock();
+  if (msgq_notify_table() == NULL){
+    return -1;
+  }
 
   const char * prefix = "/dev/shm/";
   char * full_path = new char[strlen(path) + strlen(prefix) + 1];
   strcpy(full_path, prefix);
   strcat(full_path, path);
 
-  auto fd = open(full_path, O_RDWR | O_CREAT, 0777);
-  if (fd < 0) {
-    std::cout << "Warning, could not open: " << full_path << std::endl;
-    delete[] full_path;
-    return -1;
-  }
-  delete[] full_path;
+  int fd = -1;
+  char * mem = NULL;
+  for (int attempt = 0; attempt < 2 && mem == NULL; attempt++){
+    fd = open(full_path, O_RDWR | O_CREAT, 0777);
+    if (fd < 0) {
+      std::cout << "Warning, could not open: " << full_path << std::endl;
+      delete[] full_path;
+      return -1;
+    }
 
-  int rc = ftruncate(fd, size + sizeof(msgq_header_t));
-  if (rc < 0){
-    close(fd);
-    return -1;
+    mem = msgq_map_queue(fd, size + MSGQ_HEADER_SIZE(max_readers));
+    if (mem == NULL){
+      break;
+    }
+
+    if (!msgq_check_version((msgq_header_t *)mem, fd, full_path)){
+      munmap(mem, size + MSGQ_HEADER_SIZE(max_readers));
+      close(fd);
+      mem = NULL;
+      fd = -1;
+    }
   }
-  char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  close(fd);
+  delete[] full_path;
 
   if (mem == NULL){
+    if (fd >= 0) close(fd);
     return -1;
   }
-  q->mmap_p = mem;
 
+  // The first process to open the queue decides on the publisher mode and the number of reader slots
   msgq_header_t *header = (msgq_header_t *)mem;
+  flags |= MSGQ_FLAGS_VALID;
+  uint64_t cur_flags = 0;
+  std::atomic<uint64_t> *header_flags = reinterpret_cast<std::atomic<uint64_t>*>(&header->flags);
+  if (!std::atomic_compare_exchange_strong(header_flags, &cur_flags, flags) && cur_flags != flags){
+    std::cout << "Warning, " << path << " was opened with a different publisher mode" << std::endl;
+    flags = cur_flags;
+  }
+
+  uint64_t cur_max_readers = 0;
+  std::atomic<uint64_t> *header_max_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->max_readers);
+  if (!std::atomic_compare_exchange_strong(header_max_readers, &cur_max_readers, max_readers) &&
+      cur_max_readers != max_readers){
+    std::cout << "Warning, " << path << " has " << cur_max_readers << " reader slots instead of " << max_readers << std::endl;
+    munmap(mem, size + MSGQ_HEADER_SIZE(max_readers));
+
+    max_readers = cur_max_readers;
+    mem = msgq_map_queue(fd, size + MSGQ_HEADER_SIZE(max_readers));
+    if (mem == NULL){
+      close(fd);
+      return -1;
+    }
+    header = (msgq_header_t *)mem;
+  }
+  close(fd);
+
+  q->mmap_p = mem;
 
   // Setup pointers to header segment
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
+  q->last_msg_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->last_msg_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
-
-  for (size_t i = 0; i < NUM_READERS; i++){
-    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
-    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
-    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
+  q->num_evictions = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_evictions);
+  q->num_msgs = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_msgs);
+  q->num_bytes = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_bytes);
+  q->reserve_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->reserve_pointer);
+  q->reserve_lock = reinterpret_cast<std::atomic<uint64_t>*>(&header->reserve_lock);
+  q->multiple_publishers = flags & MSGQ_FLAGS_MULTIPLE_PUBLISHERS;
+  q->latest_value = flags & MSGQ_FLAGS_LATEST_VALUE;
+
+  msgq_reader_t *readers = (msgq_reader_t *)(mem + sizeof(msgq_header_t));
+
+  q->max_readers = max_readers;
+  q->read_pointers.resize(max_readers);
+  q->read_valids.resize(max_readers);
+  q->read_uids.resize(max_readers);
+  q->read_notify.resize(max_readers);
+  q->read_overruns.resize(max_readers);
+  for (size_t i = 0; i < max_readers; i++){
+    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_pointer);
+    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_valid);
+    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_uid);
+    q->read_notify[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_notify);
+    q->read_overruns[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_overruns);
   }
 
-  q->data = mem + sizeof(msgq_header_t);
+  q->data = mem + MSGQ_HEADER_SIZE(max_readers);
   q->size = size;
   q->reader_id = -1;
+  q->read_uid_local = 0;
+  q->reconnect_nanos = 0;
+
+  q->latest = q->latest_value ? (msgq_latest_t *)q->data : NULL;
+  q->latest_slot_size = ((size - sizeof(msgq_latest_t)) / 2) & ~(uint64_t)(CACHE_LINE_SIZE - 1);
+  q->latest_read_seq = 0;
+  q->latest_subscriber_id = -1;
 
   q->endpoint = path;
   q->read_conflate = false;
+  q->borrowed = false;
+  q->reserved_size = 0;
+  q->reserved_pointer = 0;
 
   return 0;
 }
 
 void msgq_close_queue(msgq_queue_t *q){
+  msgq_close_fd(q);
+
   if (q->mmap_p != NULL){
-    munmap(q->mmap_p, q->size + sizeof(msgq_header_t));
+    // Give up the reader slot so it can be reused right away
+    int id = q->reader_id;
+    if (id >= 0){
+      uint64_t uid = q->read_uid_local;
+      if (std::atomic_compare_exchange_strong(q->read_uids[id], &uid, (uint64_t)0)){
+        *q->read_valids[id] = false;
+      }
+    }
+
+    if (q->latest_value && q->latest_subscriber_id >= 0){
+      uint64_t uid = q->read_uid_local;
+      std::atomic_compare_exchange_strong(msgq_latest_subscriber(q, q->latest_subscriber_id), &uid, (uint64_t)0);
+    }
+
+    munmap(q->mmap_p, q->size + MSGQ_HEADER_SIZE(q->max_readers));
   }
 }
 
@@ -145,95 +489,397 @@ void msgq_close_queue(msgq_queue_t *q){
 void msgq_init_publisher(msgq_queue_t * q) {
   //std::cout << "Starting publisher" << std::endl;
   uint64_t uid = msgq_get_uid();
+  q->write_uid_local = uid;
+
+  // Publishers share the queue, a new one doesn't take over from the others
+  if (q->multiple_publishers){
+    return;
+  }
 
   *q->write_uid = uid;
+
+  // Subscribers of a latest value queue keep their slots, the message count just continues
+  if (q->latest_value){
+    return;
+  }
+
   *q->num_readers = 0;
 
-  for (size_t i = 0; i < NUM_READERS; i++){
+  for (size_t i = 0; i < q->max_readers; i++){
     *q->read_valids[i] = false;
     *q->read_uids[i] = 0;
   }
+}
 
-  q->write_uid_local = uid;
+static bool msgq_process_alive(uint64_t uid){
+  pid_t pid = uid & 0xFFFFFFFF;
+  return kill(pid, 0) == 0 || errno != ESRCH;
 }
 
-static void thread_signal(uint32_t tid) {
-  #ifndef SYS_tkill
-    // TODO: this won't work for multithreaded programs
-    kill(tid, SIGUSR2);
-  #else
-    syscall(SYS_tkill, tid, SIGUSR2);
-  #endif
+int msgq_evict_dead_readers(msgq_queue_t * q){
+  int evicted = 0;
+
+  for (uint64_t i = 0; i < q->max_readers; i++){
+    uint64_t uid = *q->read_uids[i];
+    if (uid == 0 || msgq_process_alive(uid)){
+      continue;
+    }
+
+    if (std::atomic_compare_exchange_strong(q->read_uids[i], &uid, (uint64_t)0)){
+      *q->read_valids[i] = false;
+      q->num_evictions->fetch_add(1);
+      evicted++;
+    }
+  }
+
+  if (q->latest_value){
+    for (int i = 0; i < MSGQ_LATEST_MAX_SUBSCRIBERS; i++){
+      uint64_t uid = *msgq_latest_subscriber(q, i);
+      if (uid == 0 || msgq_process_alive(uid)){
+        continue;
+      }
+
+      if (std::atomic_compare_exchange_strong(msgq_latest_subscriber(q, i), &uid, (uint64_t)0)){
+        q->num_evictions->fetch_add(1);
+        evicted++;
+      }
+    }
+  }
+
+  return evicted;
 }
 
-void msgq_init_subscriber(msgq_queue_t * q) {
+int msgq_init_subscriber(msgq_queue_t * q) {
   assert(q != NULL);
   assert(q->num_readers != NULL);
 
   uint64_t uid = msgq_get_uid();
 
-  // Get reader id
-  while (true){
-    uint64_t cur_num_readers = *q->num_readers;
-    uint64_t new_num_readers = cur_num_readers + 1;
-
-    // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
-      std::cout << "Warning, evicting all subscribers!" << std::endl;
-      *q->num_readers = 0;
-
-      for (size_t i = 0; i < NUM_READERS; i++){
-        *q->read_valids[i] = false;
+  if (q->latest_value){
+    // Keep the subscriber slot when subscribing again, unless it was reaped in the meantime
+    int id = q->latest_subscriber_id;
+    uint64_t old_uid = q->read_uid_local;
+    if (id < 0 || !std::atomic_compare_exchange_strong(msgq_latest_subscriber(q, id), &old_uid, uid)){
+      id = msgq_latest_claim_subscriber(q, uid);
+      if (id < 0 && msgq_evict_dead_readers(q) > 0){
+        id = msgq_latest_claim_subscriber(q, uid);
+      }
+      if (id < 0){
+        std::cout << "Warning, no subscriber slots left for " << q->endpoint << ", the publisher won't wait for it" << std::endl;
+      }
+    }
+    q->latest_subscriber_id = id;
 
-        uint64_t old_uid = *q->read_uids[i];
-        *q->read_uids[i] = 0;
+    // Like a regular reader, only get messages sent from now on, so it is up to date with the current one
+    q->read_uid_local = uid;
+    q->latest_read_seq = *q->write_pointer;
+    msgq_latest_count_read(q, q->latest_read_seq);
+    return 0;
+  }
 
-        // Wake up reader in case they are in a poll
-        thread_signal(old_uid & 0xFFFFFFFF);
+  // Get reader id
+  while (true){
+    // Use atomic compare and swap to claim a free slot, this handles
+    // the race condition where two subscribers start at the same time
+    int id = -1;
+    for (uint64_t i = 0; i < q->max_readers; i++){
+      uint64_t free_uid = 0;
+      if (*q->read_uids[i] == 0 && std::atomic_compare_exchange_strong(q->read_uids[i], &free_uid, uid)){
+        id = i;
+        break;
       }
-
-      continue;
     }
 
-    // Use atomic compare and swap to handle race condition
-    // where two subscribers start at the same time
-    if (std::atomic_compare_exchange_strong(q->num_readers,
-                                            &cur_num_readers,
-                                            new_num_readers)){
-      q->reader_id = cur_num_readers;
+    if (id >= 0){
+      q->reader_id = id;
       q->read_uid_local = uid;
 
       // We start with read_valid = false,
       // on the first read the read pointer will be synchronized with the write pointer
-      *q->read_valids[cur_num_readers] = false;
-      *q->read_pointers[cur_num_readers] = 0;
-      *q->read_uids[cur_num_readers] = uid;
+      *q->read_valids[id] = false;
+      *q->read_pointers[id] = 0;
+      *q->read_notify[id] = (q->fd_bridge != NULL) ? (uint64_t)q->fd_bridge->slot : msgq_notify_slot();
+      *q->read_overruns[id] = 0;
+
+      // Make sure the publisher looks at this slot
+      uint64_t cur_num_readers = *q->num_readers;
+      while (cur_num_readers < (uint64_t)id + 1 &&
+             !std::atomic_compare_exchange_strong(q->num_readers, &cur_num_readers, (uint64_t)id + 1)){
+        ;
+      }
       break;
     }
+
+    // No more slots available. Make room by evicting readers that no longer exist,
+    // live readers are never kicked out
+    if (msgq_evict_dead_readers(q) == 0){
+      std::cout << "Warning, no reader slots left for " << q->endpoint << std::endl;
+      q->reader_id = -1;
+      return -1;
+    }
   }
 
   //std::cout << "New subscriber id: " << q->reader_id << " uid: " << q->read_uid_local << " " << q->endpoint << std::endl;
   msgq_reset_reader(q);
+  return 0;
 }
 
-int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+// True if packed pointer a is further along the queue than b
+static bool msgq_pointer_ahead(uint64_t a, uint64_t b){
+  uint32_t a_cycles, a_pointer, b_cycles, b_pointer;
+  UNPACK64(a_cycles, a_pointer, a);
+  UNPACK64(b_cycles, b_pointer, b);
+  return (int32_t)(a_cycles - b_cycles) > 0 || (a_cycles == b_cycles && a_pointer > b_pointer);
+}
+
+// Must be called after the write pointer moved past the message
+static void msgq_update_last_msg(msgq_queue_t *q, uint64_t msg_pointer){
+  uint64_t cur = *q->last_msg_pointer;
+  while (msgq_pointer_ahead(msg_pointer, cur) && !std::atomic_compare_exchange_weak(q->last_msg_pointer, &cur, msg_pointer)){
+    ;
+  }
+}
+
+// Moves the write pointer past all messages that are committed. With multiple publishers
+// messages can be committed out of order, whoever commits the oldest one moves it along.
+static void msgq_advance_write_pointer(msgq_queue_t *q){
+  while (true){
+    uint64_t cur = *q->write_pointer;
+    if (cur == *q->reserve_pointer){
+      break;
+    }
+
+    uint32_t cycles, ptr;
+    UNPACK64(cycles, ptr, cur);
+
+    std::atomic<int64_t> *tag_p = reinterpret_cast<std::atomic<int64_t>*>(q->data + ptr);
+    int64_t tag = *tag_p;
+
+    uint64_t next;
+    bool is_msg = false;
+    if (tag == -1){
+      cycles++;
+      PACK64(next, cycles, 0);
+    } else {
+      is_msg = !(tag & (MSGQ_TAG_PENDING | MSGQ_TAG_SKIP));
+      if (tag & MSGQ_TAG_PENDING){
+        // Still being written, unless the publisher died before committing
+        if (msgq_process_alive(MSGQ_TAG_PID(tag)) || *q->write_pointer != cur){
+          break;
+        }
+        if (!std::atomic_compare_exchange_strong(tag_p, &tag, (int64_t)(MSGQ_TAG_SKIP | MSGQ_TAG_SIZE(tag)))){
+          continue;
+        }
+      }
+      PACK64(next, cycles, ALIGN(ptr + sizeof(int64_t) + MSGQ_TAG_SIZE(tag)));
+    }
+
+    if (std::atomic_compare_exchange_strong(q->write_pointer, &cur, next) && is_msg){
+      msgq_update_last_msg(q, cur);
+    }
+  }
+}
+
+static void msgq_lock_reserve(msgq_queue_t *q){
+  int spins = 0;
+  uint64_t owner = 0;
+  while (!std::atomic_compare_exchange_weak(q->reserve_lock, &owner, q->write_uid_local)){
+    // Take over the lock if the publisher holding it died
+    if (owner != 0 && ++spins % 1000 == 0 && !msgq_process_alive(owner) &&
+        std::atomic_compare_exchange_strong(q->reserve_lock, &owner, q->write_uid_local)){
+      break;
+    }
+    owner = 0;
+    sched_yield();
+  }
+}
+
+// With multiple publishers the reserve pointer can run ahead of the write pointer. Don't let it
+// lap the write pointer, the message there is still being written or not read by anyone yet.
+static void msgq_wait_for_commits(msgq_queue_t *q, uint32_t cycles, uint64_t start, uint64_t end){
+  while (true){
+    uint32_t write_cycles, write_pointer;
+    UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+    if (write_cycles == cycles || write_pointer < start || write_pointer >= end){
+      break;
+    }
+
+    msgq_advance_write_pointer(q);
+    sched_yield();
+  }
+}
+
+// Invalidates a reader whose next message is about to be overwritten, it skips to the write pointer on its next read
+static void msgq_overrun_reader(msgq_queue_t *q, uint64_t i){
+  if (q->read_valids[i]->exchange(false)){
+    q->read_overruns[i]->fetch_add(1);
+  }
+}
+
+// Totals for msgq_stats
+static void msgq_count_msg(msgq_queue_t *q, size_t size){
+  q->num_msgs->fetch_add(1);
+  q->num_bytes->fetch_add(size);
+}
+
+// Latest value queues, see msgq_latest_t
+
+static msgq_latest_slot_t *msgq_latest_slot(msgq_queue_t *q, uint64_t n){
+  return &q->latest->slots[n % 2];
+}
+
+static char *msgq_latest_data(msgq_queue_t *q, uint64_t n){
+  return q->data + sizeof(msgq_latest_t) + (n % 2) * q->latest_slot_size;
+}
+
+static char *msgq_latest_reserve(msgq_queue_t *q, size_t size){
+  assert(size <= q->latest_slot_size);
+
+  // Message n goes into the slot that doesn't hold message n - 1, mark it as being written.
+  // If a publisher died while writing it the sequence number is still odd, keep it that way.
+  uint64_t n = *q->write_pointer + 1;
+  std::atomic<uint64_t> *seq = reinterpret_cast<std::atomic<uint64_t>*>(&msgq_latest_slot(q, n)->seq);
+  uint64_t cur_seq = *seq;
+  seq->store((cur_seq & 1) ? cur_seq + 2 : cur_seq + 1);
+  __sync_synchronize();
+
+  q->reserved_pointer = n;
+  q->reserved_size = size;
+  return msgq_latest_data(q, n);
+}
+
+static int msgq_latest_commit(msgq_queue_t *q){
+  size_t size = q->reserved_size;
+  uint64_t n = q->reserved_pointer;
+  q->reserved_size = 0;
+
+  msgq_latest_slot_t *slot = msgq_latest_slot(q, n);
+  reinterpret_cast<std::atomic<uint64_t>*>(&slot->size)->store(size);
+  __sync_synchronize();
+  reinterpret_cast<std::atomic<uint64_t>*>(&slot->seq)->fetch_add(1);
+  reinterpret_cast<std::atomic<uint64_t>*>(&q->latest->read_count)->store(MSGQ_LATEST_READ_COUNT(n));
+  *q->write_pointer = n;
+  msgq_count_msg(q, size);
+
+  for (size_t i = 0; i < NUM_NOTIFY_SLOTS / 64; i++){
+    std::atomic<uint64_t> *wake_mask = reinterpret_cast<std::atomic<uint64_t>*>(&q->latest->wake_mask[i]);
+    uint64_t mask = (*wake_mask != 0) ? wake_mask->exchange(0) : 0;
+    while (mask){
+      msgq_notify(i * 64 + __builtin_ctzll(mask));
+      mask &= mask - 1;
+    }
+  }
+  if (q->sim_clock != NULL){
+    sim_clock_wake(q->sim_clock);
+  }
+
+  return size;
+}
+
+// Finds the newest message if this reader didn't read it yet. Returns the message number
+// and the sequence number of its slot, the data is only valid if that didn't change after reading.
+static bool msgq_latest_peek(msgq_queue_t *q, char **data, size_t *size, uint64_t *n, uint64_t *seq){
+  msgq_clear_fd(q);
+
+  for (int i = 0; i < MSGQ_LATEST_MAX_RETRIES; i++){
+    *n = *q->write_pointer;
+    if (*n == q->latest_read_seq){
+      return false;
+    }
+
+    msgq_latest_slot_t *slot = msgq_latest_slot(q, *n);
+    *seq = *reinterpret_cast<std::atomic<uint64_t>*>(&slot->seq);
+    *size = *reinterpret_cast<std::atomic<uint64_t>*>(&slot->size);
+
+    // The publisher is already writing message n + 2 to this slot, so n + 1 is out.
+    // It only takes a retry, unless the publisher is descheduled or died in the middle.
+    if ((*seq & 1) || *size > q->latest_slot_size){
+      if (i > 0) sched_yield();
+      continue;
+    }
+
+    *data = msgq_latest_data(q, *n);
+    return true;
+  }
+
+  // Nothing to read for now, the next message ends up in the other slot
+  return false;
+}
+
+static bool msgq_latest_valid(msgq_queue_t *q, uint64_t n, uint64_t seq){
+  __sync_synchronize();
+  return *reinterpret_cast<std::atomic<uint64_t>*>(&msgq_latest_slot(q, n)->seq) == seq;
+}
+
+static int msgq_latest_recv(msgq_msg_t *msg, msgq_queue_t *q){
+  while (true){
+    char *data;
+    size_t size;
+    uint64_t n, seq;
+    if (!msgq_latest_peek(q, &data, &size, &n, &seq)){
+      msg->size = 0;
+      return 0;
+    }
+
+    if (msgq_msg_init_size(msg, size) < 0)
+      return -1;
+
+    memcpy(msg->data, data, size);
+
+    if (msgq_latest_valid(q, n, seq)){
+      q->latest_read_seq = n;
+      msgq_latest_count_read(q, n);
+      return msg->size;
+    }
+
+    msgq_msg_close(msg);
+  }
+}
+
+static int msgq_latest_borrow(msgq_msg_t *msg, msgq_queue_t *q){
+  uint64_t n, seq;
+  if (!msgq_latest_peek(q, &msg->data, &msg->size, &n, &seq)){
+    msg->size = 0;
+    return 0;
+  }
+
+  // Checked again in msgq_msg_release
+  q->latest_read_seq = n;
+  msgq_latest_count_read(q, n);
+  q->borrowed_read_pointer = seq;
+  q->borrowed = true;
+  return msg->size;
+}
+
+char * msgq_msg_reserve(msgq_queue_t *q, size_t size){
   // Die if we are no longer the active publisher
-  if (q->write_uid_local != *q->write_uid){
+  if (!q->multiple_publishers && q->write_uid_local != *q->write_uid){
     std::cout << "Killing old publisher: " << q->endpoint << std::endl;
     errno = EADDRINUSE;
-    return -1;
+    return NULL;
   }
 
-  uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
+  if (q->latest_value){
+    return msgq_latest_reserve(q, size);
+  }
+
+  uint64_t total_msg_size = ALIGN(size + sizeof(int64_t));
 
   // We need to fit at least three messages in the queue,
   // then we can always safely access the last message
   assert(3 * total_msg_size <= q->size);
 
+  // Publishers claim space one at a time, the messages are written in parallel
+  std::atomic<uint64_t> *reserve_pointer = q->write_pointer;
+  if (q->multiple_publishers){
+    msgq_lock_reserve(q);
+    reserve_pointer = q->reserve_pointer;
+  }
+
   uint64_t num_readers = *q->num_readers;
 
   uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  UNPACK64(write_cycles, write_pointer, *reserve_pointer);
 
   char *p = q->data + write_pointer; // add base offset
 
@@ -241,6 +887,10 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
   // Always leave space for a wraparound tag for the next message, including alignment
   int64_t remaining_space = q->size - write_pointer - total_msg_size - sizeof(int64_t);
   if (remaining_space <= 0){
+    if (q->multiple_publishers){
+      msgq_wait_for_commits(q, write_cycles, write_pointer, q->size);
+    }
+
     // Write -1 size tag indicating wraparound
     *(int64_t*)p = -1;
 
@@ -252,14 +902,14 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
       read_pointer &= 0xFFFFFFFF;
 
       if ((read_pointer > write_pointer) && (read_cycles != write_cycles)) {
-        *q->read_valids[i] = false;
+        msgq_overrun_reader(q, i);
       }
     }
 
     // Update global and local copies of write pointer and write_cycles
     write_pointer = 0;
     write_cycles = write_cycles + 1;
-    PACK64(*q->write_pointer, write_cycles, write_pointer);
+    PACK64(*reserve_pointer, write_cycles, write_pointer);
 
     // Set actual pointer to the beginning of the data segment
     p = q->data;
@@ -267,50 +917,134 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
 
   // Invalidate readers that are in the area that will be written
   uint64_t start = write_pointer;
-  uint64_t end = ALIGN(start + sizeof(int64_t) + msg->size);
+  uint64_t end = ALIGN(start + sizeof(int64_t) + size);
+
+  if (q->multiple_publishers){
+    msgq_wait_for_commits(q, write_cycles, start, end);
+  }
 
   for (uint64_t i = 0; i < num_readers; i++){
     uint32_t read_cycles, read_pointer;
     UNPACK64(read_cycles, read_pointer, *q->read_pointers[i]);
 
     if ((read_pointer >= start) && (read_pointer < end) && (read_cycles != write_cycles)) {
-      *q->read_valids[i] = false;
+      msgq_overrun_reader(q, i);
     }
   }
 
 
   // Write size tag
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
-  *size_p = msg->size;
 
-  // Copy data
-  memcpy(p + sizeof(int64_t), msg->data, msg->size);
+  if (q->multiple_publishers){
+    // Mark the message as pending until it is committed, and let the next publisher in
+    *size_p = MSGQ_TAG_PENDING | ((uint64_t)getpid() & 0x3FFFFF) << 32 | size;
+    PACK64(q->reserved_pointer, write_cycles, write_pointer);
+    PACK64(*q->reserve_pointer, write_cycles, end);
+    *q->reserve_lock = 0;
+  } else {
+    *size_p = size;
+  }
+
+  q->reserved_size = size;
+  return p + sizeof(int64_t);
+}
+
+int msgq_msg_commit(msgq_queue_t *q){
+  if (q->latest_value){
+    return msgq_latest_commit(q);
+  }
+
+  size_t size = q->reserved_size;
+  q->reserved_size = 0;
+
   __sync_synchronize();
 
-  // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
-  PACK64(*q->write_pointer, write_cycles, new_ptr);
+  if (q->multiple_publishers){
+    uint32_t reserved_pointer = q->reserved_pointer & 0xFFFFFFFF;
+
+    std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(q->data + reserved_pointer);
+    *size_p = size;
+
+    msgq_advance_write_pointer(q);
+  } else {
+    // Update write pointer
+    uint32_t write_cycles, write_pointer;
+    UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+    uint32_t new_ptr = ALIGN(write_pointer + size + sizeof(int64_t));
+    PACK64(*q->write_pointer, write_cycles, new_ptr);
+
+    uint64_t msg_pointer;
+    PACK64(msg_pointer, write_cycles, write_pointer);
+    msgq_update_last_msg(q, msg_pointer);
+  }
+  msgq_count_msg(q, size);
 
   // Notify readers
+  uint64_t num_readers = *q->num_readers;
   for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
+    if (*q->read_uids[i] != 0){
+      msgq_notify(*q->read_notify[i]);
+    }
+  }
+  // Pollers on the simulated clock wait on the clock instead
+  if (q->sim_clock != NULL){
+    sim_clock_wake(q->sim_clock);
   }
 
-  return msg->size;
+  return size;
 }
 
+int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  char *p = msgq_msg_reserve(q, msg->size);
+  if (p == NULL){
+    return -1;
+  }
+
+  // Copy data
+  memcpy(p, msg->data, msg->size);
+
+  return msgq_msg_commit(q);
+}
+
+
+// A reader loses its slot when a new publisher takes over, it then tries to get a new one. That scans all
+// slots and checks if their owners are alive, so after a failed attempt it only tries again every MSGQ_RECONNECT_MS.
+static bool msgq_reader_connected(msgq_queue_t *q){
+  assert(q->read_uid_local != 0); // Make sure subscriber is initialized
 
-int msgq_msg_ready(msgq_queue_t * q){
- start:
   int id = q->reader_id;
-  assert(id >= 0); // Make sure subscriber is initialized
+  if (id >= 0 && q->read_uid_local == *q->read_uids[id]){
+    return true;
+  }
 
-  if (q->read_uid_local != *q->read_uids[id]){
+  if (id >= 0){
     std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
-    msgq_init_subscriber(q);
-    goto start;
+    q->reader_id = -1;
+  }
+
+  uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  if (now < q->reconnect_nanos){
+    return false;
+  }
+
+  if (msgq_init_subscriber(q) != 0){
+    q->reconnect_nanos = now + MSGQ_RECONNECT_MS * 1000000ULL;
+    return false;
+  }
+  return true;
+}
+
+int msgq_msg_ready(msgq_queue_t * q){
+  if (q->latest_value){
+    return *q->write_pointer != q->latest_read_seq;
+  }
+
+ start:
+  if (!msgq_reader_connected(q)){
+    return 0;
   }
+  int id = q->reader_id;
 
   // Check valid
   if (!*q->read_valids[id]){
@@ -328,16 +1062,16 @@ int msgq_msg_ready(msgq_queue_t * q){
   return (read_pointer != write_pointer);
 }
 
-int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
- start:
-  int id = q->reader_id;
-  assert(id >= 0); // Make sure subscriber is initialized
+// Finds the next message for this reader without consuming it. Returns the size
+// and points data at the payload in the ring, or returns 0 if there is no new message.
+static int64_t msgq_msg_peek(msgq_queue_t * q, char ** data, uint64_t * next_read_pointer){
+  msgq_clear_fd(q);
 
-  if (q->read_uid_local != *q->read_uids[id]){
-    std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
-    msgq_init_subscriber(q);
-    goto start;
+ start:
+  if (!msgq_reader_connected(q)){
+    return 0;
   }
+  int id = q->reader_id;
 
   // Check valid
   if (!*q->read_valids[id]){
@@ -345,17 +1079,23 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     goto start;
   }
 
+  // The last message pointer is only moved after the write pointer, so load it first
+  uint64_t last_msg_pointer = *q->last_msg_pointer;
+
+  uint32_t write_pointer = *q->write_pointer & 0xFFFFFFFF;
+
+  // Conflating readers only want the newest message, jump straight to it
+  if (q->read_conflate && msgq_pointer_ahead(last_msg_pointer, *q->read_pointers[id])){
+    *q->read_pointers[id] = last_msg_pointer;
+  }
+
   uint32_t read_cycles, read_pointer;
   UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
 
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
-
   char * p = q->data + read_pointer;
 
   // Check if new message is available
   if (read_pointer == write_pointer) {
-    msg->size = 0;
     return 0;
   }
 
@@ -376,6 +1116,12 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     goto start;
   }
 
+  // Skip messages that a publisher never finished
+  if (size & MSGQ_TAG_SKIP){
+    PACK64(*q->read_pointers[id], read_cycles, ALIGN(read_pointer + sizeof(int64_t) + MSGQ_TAG_SIZE(size)));
+    goto start;
+  }
+
   // crashing is better than passing garbage data to the consumer
   // the size will have weird value if it was overwritten by data accidentally
   assert((uint64_t)size < q->size);
@@ -392,73 +1138,246 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     }
   }
 
-  // Copy message
-  if (msgq_msg_init_size(msg, size) < 0)
-    return -1;
+  *data = p + sizeof(int64_t);
+  PACK64(*next_read_pointer, read_cycles, new_read_pointer);
+  return size;
+}
 
-  __sync_synchronize();
-  memcpy(msg->data, p + sizeof(int64_t), size);
-  __sync_synchronize();
+int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  assert(!q->borrowed);
 
-  // Update read pointer
-  PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+  if (q->latest_value){
+    return msgq_latest_recv(msg, q);
+  }
+
+  while (true){
+    char * data;
+    uint64_t next_read_pointer;
+    int64_t size = msgq_msg_peek(q, &data, &next_read_pointer);
+
+    if (size == 0){
+      msg->size = 0;
+      return 0;
+    }
+
+    // Copy message
+    if (msgq_msg_init_size(msg, size) < 0)
+      return -1;
+
+    __sync_synchronize();
+    memcpy(msg->data, data, size);
+    __sync_synchronize();
+
+    // Update read pointer
+    *q->read_pointers[q->reader_id] = next_read_pointer;
+
+    // Check if the actual data that was copied is valid
+    if (*q->read_valids[q->reader_id]){
+      return msg->size;
+    }
 
-  // Check if the actual data that was copied is valid
-  if (!*q->read_valids[id]){
     msgq_msg_close(msg);
     msgq_reset_reader(q);
-    goto start;
   }
+}
 
+int msgq_msg_borrow(msgq_msg_t * msg, msgq_queue_t * q){
+  assert(!q->borrowed);
 
-  return msg->size;
+  if (q->latest_value){
+    return msgq_latest_borrow(msg, q);
+  }
+
+  // The read pointer is left on the borrowed message until it is released,
+  // so the publisher invalidates this reader when it overwrites the message
+  int64_t size = msgq_msg_peek(q, &msg->data, &q->borrowed_read_pointer);
+  msg->size = size;
+  q->borrowed = size > 0;
+
+  return size;
 }
 
+int msgq_msg_borrow_batch(msgq_msg_t * msgs, size_t max_msgs, size_t max_bytes, msgq_queue_t * q){
+  assert(!q->borrowed);
+  assert(max_msgs > 0);
 
+  // Conflating readers only ever get the latest message
+  if (q->read_conflate || q->latest_value){
+    return msgq_msg_borrow(&msgs[0], q);
+  }
 
-int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
-  int num = 0;
+  msgq_clear_fd(q);
 
-  // Check if messages ready
-  for (size_t i = 0; i < nitems; i++) {
-    items[i].revents = msgq_msg_ready(items[i].q);
-    if (items[i].revents) num++;
+  // Make sure the reader is connected and valid before walking the queue
+  if (!msgq_msg_ready(q)){
+    return 0;
   }
 
-  int ms = (timeout == -1) ? 100 : timeout;
-  struct timespec ts;
-  ts.tv_sec = ms / 1000;
-  ts.tv_nsec = (ms % 1000) * 1000 * 1000;
+  int id = q->reader_id;
 
+  uint32_t read_cycles, read_pointer;
+  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
 
-  while (num == 0) {
-    int ret;
+  uint32_t write_pointer = *q->write_pointer & 0xFFFFFFFF;
 
-    ret = nanosleep(&ts, &ts);
+  // Walk the queue up to the write pointer. The read pointer is left at the start of the batch, so
+  // an overwrite of any message in it invalidates the reader and is caught in msgq_msg_release
+  size_t num = 0, bytes = 0;
+  while (num < max_msgs && read_pointer != write_pointer){
+    int64_t size = *reinterpret_cast<std::atomic<int64_t>*>(q->data + read_pointer);
 
-    // Check if messages ready
+    if (size == -1){
+      read_cycles++;
+      read_pointer = 0;
+      continue;
+    }
+
+    if (size & MSGQ_TAG_SKIP){
+      read_pointer = ALIGN(read_pointer + sizeof(int64_t) + MSGQ_TAG_SIZE(size));
+      continue;
+    }
+
+    if (size <= 0 || (uint64_t)size >= q->size){
+      // Only possible if we were overwritten while walking
+      assert(!*q->read_valids[id]);
+      break;
+    }
+
+    if (num > 0 && bytes + size > max_bytes){
+      break;
+    }
+
+    msgs[num].data = q->data + read_pointer + sizeof(int64_t);
+    msgs[num].size = size;
+    num++;
+    bytes += size;
+
+    read_pointer = ALIGN(read_pointer + sizeof(int64_t) + size);
+  }
+
+  PACK64(q->borrowed_read_pointer, read_cycles, read_pointer);
+  q->borrowed = num > 0;
+
+  return num;
+}
+
+int msgq_msg_release(msgq_queue_t * q){
+  assert(q->borrowed);
+  q->borrowed = false;
+
+  if (q->latest_value){
+    return msgq_latest_valid(q, q->latest_read_seq, q->borrowed_read_pointer) ? 0 : -1;
+  }
+
+  if (!*q->read_valids[q->reader_id]){
+    msgq_reset_reader(q);
+    return -1;
+  }
+
+  *q->read_pointers[q->reader_id] = q->borrowed_read_pointer;
+  return 0;
+}
+
+
+
+static int msgq_poll_wall(msgq_pollitem_t * items, size_t nitems, int timeout){
+  uint32_t slot = msgq_notify_slot();
+  msgq_notify_t *n = &msgq_notify_table()[slot];
+  std::atomic<uint32_t> *seq = reinterpret_cast<std::atomic<uint32_t>*>(&n->seq);
+  std::atomic<uint32_t> *waiters = reinterpret_cast<std::atomic<uint32_t>*>(&n->waiters);
+
+  // Make sure publishers wake up this thread, it might not be the one that created the subscriber
+  for (size_t i = 0; i < nitems; i++) {
+    msgq_queue_t *q = items[i].q;
+    if (!q->latest_value && q->reader_id >= 0 && *q->read_notify[q->reader_id] != slot){
+      *q->read_notify[q->reader_id] = slot;
+    }
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  int num = 0;
+
+  while (true) {
+    // Latest value queues forget the pollers they woke, register before checking
     for (size_t i = 0; i < nitems; i++) {
-      if (items[i].revents == 0 && msgq_msg_ready(items[i].q)){
-        num += 1;
-        items[i].revents = 1;
+      if (items[i].q->latest_value){
+        msgq_latest_register(items[i].q, slot);
       }
     }
 
-    // exit if we had a timeout and the sleep finished
-    if (timeout != -1 && ret == 0){
+    // Sample the sequence number before checking, so a message sent
+    // after the check makes the futex wait return immediately
+    uint32_t cur_seq = *seq;
+
+    // Check if messages ready
+    for (size_t i = 0; i < nitems; i++) {
+      items[i].revents = msgq_msg_ready(items[i].q);
+      if (items[i].revents) num++;
+    }
+
+    if (num > 0){
       break;
     }
+
+    int ms = 100;
+    if (timeout != -1){
+      auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0){
+        break;
+      }
+      ms = std::min(remaining.count(), (decltype(remaining.count()))ms);
+    }
+
+    waiters->fetch_add(1);
+    futex_wait(seq, cur_seq, ms);
+    waiters->fetch_sub(1);
   }
 
   return num;
 }
 
+int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
+  sim_clock_t *c = (nitems > 0) ? items[0].q->sim_clock : NULL;
+  if (c == NULL || timeout == 0){
+    return msgq_poll_wall(items, nitems, timeout);
+  }
+
+  // On the simulated clock the timeout is simulated time, and the thread is idle while it waits.
+  // Publishers wake the clock as well as the notify slots, so checking for messages doesn't block.
+  int num = 0;
+  uint64_t deadline = (timeout < 0) ? UINT64_MAX : c->nanos + timeout * 1000000ULL;
+  sim_clock_wait_until(c, deadline, [&]() {
+    num = msgq_poll_wall(items, nitems, 0);
+    return num > 0;
+  });
+  return num;
+}
+
+static bool msgq_latest_all_read(msgq_queue_t *q) {
+  uint64_t num_subscribers = 0;
+  for (int i = 0; i < MSGQ_LATEST_MAX_SUBSCRIBERS; i++) {
+    num_subscribers += *msgq_latest_subscriber(q, i) != 0;
+  }
+  uint64_t read_count = *reinterpret_cast<std::atomic<uint64_t>*>(&q->latest->read_count);
+  return num_subscribers > 0 && (read_count & ~0xFFFFULL) == MSGQ_LATEST_READ_COUNT(*q->write_pointer) &&
+         (read_count & 0xFFFF) >= num_subscribers;
+}
+
 bool msgq_all_readers_updated(msgq_queue_t *q) {
+  // Readers of a latest value queue only count themselves, a dead one would hold the publisher up until it is reaped
+  if (q->latest_value) {
+    return msgq_latest_all_read(q) || (msgq_evict_dead_readers(q) > 0 && msgq_latest_all_read(q));
+  }
+
   uint64_t num_readers = *q->num_readers;
+  bool any_reader = false;
   for (uint64_t i = 0; i < num_readers; i++) {
+    if (*q->read_uids[i] == 0) continue;
+    any_reader = true;
+
     if (*q->read_valids[i] && *q->write_pointer != *q->read_pointers[i]) {
       return false;
     }
   }
-  return num_readers > 0;
+  return any_reader;
 }
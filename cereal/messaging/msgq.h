@@ -3,38 +3,147 @@
 #include <cstring>
 #include <string>
 #include <atomic>
+#include <vector>
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
-#define NUM_READERS 10
+#define DEFAULT_NUM_READERS 16
+#define NUM_NOTIFY_SLOTS 4096
+// A reader that lost its slot and couldn't get a new one waits this long before trying again
+#define MSGQ_RECONNECT_MS 100
+// A reader of a latest value queue gives up on a slot that stays in the middle of a write after this many tries
+#define MSGQ_LATEST_MAX_RETRIES 100
+// Subscribers of a latest value queue beyond this many can still read, but the publisher doesn't wait for them
+#define MSGQ_LATEST_MAX_SUBSCRIBERS 64
 #define ALIGN(n) ((n + (8 - 1)) & -8)
 
 #define UNPACK64(higher, lower, input) do {uint64_t tmp = input; higher = tmp >> 32; lower = tmp & 0xFFFFFFFF;} while (0)
 #define PACK64(output, higher, lower) output = ((uint64_t)higher << 32 ) | ((uint64_t)lower & 0xFFFFFFFF)
 
-struct  msgq_header_t {
+#define MSGQ_VERSION 6
+#define CACHE_LINE_SIZE 64
+
+#define MSGQ_FLAGS_VALID (1ULL << 0)
+#define MSGQ_FLAGS_MULTIPLE_PUBLISHERS (1ULL << 1)
+#define MSGQ_FLAGS_LATEST_VALUE (1ULL << 2)
+
+// In multiple publisher mode a message is pending from reserve until commit. The size tag
+// then also holds the pid of the publisher, so the slot can be skipped if that process dies.
+#define MSGQ_TAG_PENDING (1ULL << 62)
+#define MSGQ_TAG_SKIP (1ULL << 61)
+#define MSGQ_TAG_SIZE(tag) ((tag) & 0xFFFFFFFF)
+#define MSGQ_TAG_PID(tag) (((tag) >> 32) & 0x3FFFFF)
+
+struct msgq_header_t {
+  // Set up once, read by everyone
+  uint64_t version;
+  uint64_t flags;
+  uint64_t max_readers;
   uint64_t num_readers;
-  uint64_t write_pointer;
   uint64_t write_uid;
-  uint64_t read_pointers[NUM_READERS];
-  uint64_t read_valids[NUM_READERS];
-  uint64_t read_uids[NUM_READERS];
+  // Slots of dead readers that were given to new readers, for msgq_stats
+  uint64_t num_evictions;
+
+  // Written by the publisher for every message, keep it on its own cache line.
+  // Readers consume everything up to the write pointer, conflating readers
+  // skip straight to the last message. The totals are only for msgq_stats.
+  alignas(CACHE_LINE_SIZE) uint64_t write_pointer;
+  uint64_t last_msg_pointer;
+  uint64_t num_msgs;
+  uint64_t num_bytes;
+
+  // Only used with multiple publishers. Publishers take turns claiming space at the
+  // reserve pointer, the write pointer then follows as the claimed slots are committed.
+  alignas(CACHE_LINE_SIZE) uint64_t reserve_pointer;
+  uint64_t reserve_lock;
+};
+
+// Every reader updates its read pointer for every message. Each reader gets its
+// own cache line so readers on different cores don't invalidate each other.
+struct alignas(CACHE_LINE_SIZE) msgq_reader_t {
+  uint64_t read_pointer;
+  uint64_t read_valid;
+  uint64_t read_uid;
+  uint64_t read_notify;
+  // Number of times the publisher overwrote messages before this reader got to them
+  uint64_t read_overruns;
+};
+
+// The header is followed by max_readers reader slots and then the data
+#define MSGQ_HEADER_SIZE(max_readers) (sizeof(msgq_header_t) + sizeof(msgq_reader_t) * (max_readers))
+
+// Readers are woken through a futex word in a table shared by all queues.
+// A reader registers the slot of the thread that polls it, so a single
+// futex can be used to wait on any number of queues at once.
+struct msgq_notify_t {
+  uint32_t seq;
+  uint32_t waiters;
+};
+
+// A latest value queue only keeps the newest message, for services where readers never want an older one.
+// Messages are written to two slots in turn, so readers of the last message aren't disturbed by the next.
+// Each slot is a seqlock: its sequence number is odd while it is written and readers retry if it changed
+// while they read. Readers don't take a reader slot, the write pointer counts messages and each reader
+// remembers the last one it read. Subscribers only register their uid in a subscriber slot, so dead ones can be reaped. Before it waits, a poller sets the bit of its notify slot in the wake mask,
+// the publisher clears the bits it wakes.
+struct alignas(CACHE_LINE_SIZE) msgq_latest_slot_t {
+  uint64_t seq;
+  uint64_t size;
 };
 
+// Readers count themselves in read_count once they have the newest message, as
+// MSGQ_LATEST_READ_COUNT(n) + 1. The publisher resets it for every message.
+#define MSGQ_LATEST_READ_COUNT(n) (((n) & 0xFFFFFFFFFFFF) << 16)
+
+// Stored at the start of the data segment, followed by the data of both slots
+struct msgq_latest_t {
+  uint64_t wake_mask[NUM_NOTIFY_SLOTS / 64];
+  alignas(CACHE_LINE_SIZE) uint64_t subscribers[MSGQ_LATEST_MAX_SUBSCRIBERS]; // uid of the subscriber, 0 if free
+  alignas(CACHE_LINE_SIZE) uint64_t read_count;
+  msgq_latest_slot_t slots[2];
+};
+
+// Pollable file descriptor for a subscriber, see msgq_get_fd
+struct msgq_fd_bridge_t;
+struct sim_clock_t;
+
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
   std::atomic<uint64_t> *write_pointer;
+  std::atomic<uint64_t> *last_msg_pointer;
   std::atomic<uint64_t> *write_uid;
-  std::atomic<uint64_t> *read_pointers[NUM_READERS];
-  std::atomic<uint64_t> *read_valids[NUM_READERS];
-  std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::atomic<uint64_t> *num_evictions;
+  std::atomic<uint64_t> *num_msgs;
+  std::atomic<uint64_t> *num_bytes;
+  std::atomic<uint64_t> *reserve_pointer;
+  std::atomic<uint64_t> *reserve_lock;
+  std::vector<std::atomic<uint64_t>*> read_pointers;
+  std::vector<std::atomic<uint64_t>*> read_valids;
+  std::vector<std::atomic<uint64_t>*> read_uids;
+  std::vector<std::atomic<uint64_t>*> read_notify;
+  std::vector<std::atomic<uint64_t>*> read_overruns;
+  uint64_t max_readers;
   char * mmap_p;
   char * data;
   size_t size;
   int reader_id;
   uint64_t read_uid_local;
+  uint64_t reconnect_nanos;
   uint64_t write_uid_local;
+  bool multiple_publishers;
+  bool latest_value;
+  msgq_latest_t *latest;
+  size_t latest_slot_size;
+  uint64_t latest_read_seq;
+  int latest_subscriber_id;
 
   bool read_conflate;
+  bool borrowed;
+  uint64_t borrowed_read_pointer;
+  size_t reserved_size;
+  uint64_t reserved_pointer;
+  msgq_fd_bridge_t *fd_bridge;
+  // The simulated clock with SIM_CLOCK=1, publishers wake its idle participants and msgq_poll waits on it
+  sim_clock_t *sim_clock;
   std::string endpoint;
 };
 
@@ -55,14 +164,31 @@ int msgq_msg_init_size(msgq_msg_t *msg, size_t size);
 int msgq_msg_init_data(msgq_msg_t *msg, char * data, size_t size);
 int msgq_msg_close(msgq_msg_t *msg);
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
+// The first process to open a queue decides on the number of reader slots and the mode, flags can be
+// MSGQ_FLAGS_MULTIPLE_PUBLISHERS or MSGQ_FLAGS_LATEST_VALUE. Otherwise a new publisher takes over from the old one.
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers = DEFAULT_NUM_READERS, uint64_t flags = 0);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
-void msgq_init_subscriber(msgq_queue_t * q);
+int msgq_init_subscriber(msgq_queue_t * q);
+int msgq_evict_dead_readers(msgq_queue_t * q);
 
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+// Zero-copy send, the caller writes size bytes into the returned buffer and publishes them with msgq_msg_commit
+char * msgq_msg_reserve(msgq_queue_t *q, size_t size);
+int msgq_msg_commit(msgq_queue_t *q);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
+// Zero-copy receive, msg->data points into the queue and must not be closed.
+// msgq_msg_release returns -1 if the message was overwritten while it was borrowed.
+int msgq_msg_borrow(msgq_msg_t *msg, msgq_queue_t *q);
+// Borrows up to max_msgs consecutive messages (at least one, even if it is larger than max_bytes).
+// They are released together with a single msgq_msg_release.
+int msgq_msg_borrow_batch(msgq_msg_t *msgs, size_t max_msgs, size_t max_bytes, msgq_queue_t *q);
+int msgq_msg_release(msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
+// Returns a file descriptor that becomes readable when new messages are written, so a subscriber can be
+// added to epoll or an event loop. When it is readable, receive until there are no messages left.
+// A background thread waits for the publisher and forwards the wakeup, so don't also msgq_poll this queue.
+int msgq_get_fd(msgq_queue_t * q);
 
 bool msgq_all_readers_updated(msgq_queue_t *q);
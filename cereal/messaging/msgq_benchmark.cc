@@ -0,0 +1,344 @@
+// msgq microbenchmarks. Results are printed as JSON so they can be compared between builds.
+// Build with scons --bench and run cereal/messaging/msgq_benchmark > msgq.json
+// Don't run this while openpilot is running, it competes for the same cores.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "msgq.h"
+
+static uint64_t nanos_since_epoch() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void pin_to_core(int core) {
+#ifdef __linux__
+  int num_cores = std::thread::hardware_concurrency();
+  if (num_cores <= 1) return;
+
+  cpu_set_t cpu;
+  CPU_ZERO(&cpu);
+  CPU_SET(core % num_cores, &cpu);
+  sched_setaffinity(0, sizeof(cpu), &cpu);
+#endif
+}
+
+static double percentile(std::vector<uint64_t> &v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(v.size() * p))];
+}
+
+static std::string join(const std::vector<std::string> &items) {
+  std::string s;
+  for (size_t i = 0; i < items.size(); i++) {
+    s += (i > 0 ? ",\n    " : "") + items[i];
+  }
+  return "[\n    " + s + "\n  ]";
+}
+
+static void send(msgq_queue_t *q, char *data, size_t size) {
+  msgq_msg_t msg;
+  msg.size = size;
+  msg.data = data;
+  msgq_msg_send(&msg, q);
+}
+
+// Publish -> receive latency for a single reader that is blocked in msgq_poll, including both copies
+static std::string bench_latency(size_t msg_size, int iterations) {
+  const char *name = "msgq_bench_latency";
+  size_t queue_size = std::max((size_t)DEFAULT_SEGMENT_SIZE, (size_t)(4 * ALIGN(msg_size + sizeof(int64_t))));
+
+  msgq_queue_t q;
+  msgq_new_queue(&q, name, queue_size);
+  msgq_init_publisher(&q);
+
+  std::atomic<bool> ready = false;
+  std::atomic<int> received = 0;
+  std::vector<uint64_t> latencies;
+  std::thread reader([&]() {
+    pin_to_core(1);
+
+    msgq_queue_t q_sub;
+    msgq_new_queue(&q_sub, name, queue_size);
+    msgq_init_subscriber(&q_sub);
+    ready = true;
+
+    msgq_pollitem_t item;
+    item.q = &q_sub;
+    while (received < iterations) {
+      msgq_poll(&item, 1, 100);
+
+      msgq_msg_t msg;
+      if (msgq_msg_recv(&msg, &q_sub) > 0) {
+        latencies.push_back(nanos_since_epoch() - *(uint64_t*)msg.data);
+        msgq_msg_close(&msg);
+        received++;
+      }
+    }
+    msgq_close_queue(&q_sub);
+  });
+
+  pin_to_core(0);
+  while (!ready) std::this_thread::yield();
+
+  std::vector<char> buf(msg_size);
+  for (int i = 0; i < iterations; i++) {
+    // Wait for the previous message, this measures latency and not queueing
+    while (received != i) std::this_thread::yield();
+
+    *(uint64_t*)buf.data() = nanos_since_epoch();
+    send(&q, buf.data(), msg_size);
+  }
+  reader.join();
+  msgq_close_queue(&q);
+
+  char out[256];
+  snprintf(out, sizeof(out), "{\"size\": %zu, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+           msg_size, percentile(latencies, 0.5) / 1e3, percentile(latencies, 0.9) / 1e3,
+           percentile(latencies, 0.99) / 1e3, percentile(latencies, 1.0) / 1e3);
+  return out;
+}
+
+// One publisher sending as fast as it can to busy-polling readers that are each pinned to their own core
+static std::string bench_throughput(int num_readers, int num_msgs, size_t msg_size) {
+  const char *name = "msgq_bench_throughput";
+
+  msgq_queue_t q;
+  msgq_new_queue(&q, name, DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&q);
+
+  std::atomic<int> ready = 0;
+  std::atomic<bool> done = false;
+  std::vector<uint64_t> received(num_readers);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < num_readers; i++) {
+    readers.emplace_back([&, i]() {
+      pin_to_core(i + 1);
+
+      msgq_queue_t q_sub;
+      msgq_new_queue(&q_sub, name, DEFAULT_SEGMENT_SIZE);
+      msgq_init_subscriber(&q_sub);
+      ready++;
+
+      while (true) {
+        msgq_msg_t msg;
+        if (msgq_msg_recv(&msg, &q_sub) > 0) {
+          received[i]++;
+          msgq_msg_close(&msg);
+        } else if (done) {
+          break;
+        }
+      }
+      msgq_close_queue(&q_sub);
+    });
+  }
+
+  pin_to_core(0);
+  while (ready < num_readers) std::this_thread::yield();
+
+  std::vector<char> buf(msg_size);
+  uint64_t start = nanos_since_epoch();
+  for (int i = 0; i < num_msgs; i++) {
+    send(&q, buf.data(), msg_size);
+  }
+  double elapsed = (nanos_since_epoch() - start) / 1e9;
+  done = true;
+
+  for (auto &t : readers) t.join();
+  msgq_close_queue(&q);
+
+  uint64_t total_received = 0;
+  for (auto r : received) total_received += r;
+  double drop_ratio = 1.0 - (double)total_received / ((uint64_t)num_msgs * num_readers);
+
+  char out[256];
+  snprintf(out, sizeof(out), "{\"readers\": %d, \"size\": %zu, \"publish_msgs_per_s\": %.0f, \"drop_ratio\": %.4f}",
+           num_readers, msg_size, num_msgs / elapsed, drop_ratio);
+  return out;
+}
+
+// Time to drain a backlog of messages, a conflating reader only gets the last one
+static std::string bench_conflate(bool conflate, int backlog, int iterations) {
+  const char *name = "msgq_bench_conflate";
+
+  msgq_queue_t q, q_sub;
+  msgq_new_queue(&q, name, DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&q);
+  msgq_new_queue(&q_sub, name, DEFAULT_SEGMENT_SIZE);
+  msgq_init_subscriber(&q_sub);
+  q_sub.read_conflate = conflate;
+
+  char buf[64] = {};
+  uint64_t total = 0, msgs = 0;
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < backlog; j++) {
+      send(&q, buf, sizeof(buf));
+    }
+
+    uint64_t start = nanos_since_epoch();
+    msgq_msg_t msg;
+    while (msgq_msg_recv(&msg, &q_sub) > 0) {
+      msgq_msg_close(&msg);
+      msgs++;
+    }
+    total += nanos_since_epoch() - start;
+  }
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+
+  char out[256];
+  snprintf(out, sizeof(out), "{\"conflate\": %s, \"backlog\": %d, \"ns_per_drain\": %.0f, \"msgs_per_drain\": %.1f}",
+           conflate ? "true" : "false", backlog, (double)total / iterations, (double)msgs / iterations);
+  return out;
+}
+
+// Cost of a send that wraps around to the start of the queue compared to a regular one
+static std::string bench_wraparound(size_t msg_size, int num_msgs) {
+  const char *name = "msgq_bench_wraparound";
+  size_t queue_size = 16 * ALIGN(msg_size + sizeof(int64_t));
+
+  msgq_queue_t q, q_sub;
+  msgq_new_queue(&q, name, queue_size);
+  msgq_init_publisher(&q);
+  msgq_new_queue(&q_sub, name, queue_size);
+  msgq_init_subscriber(&q_sub);
+
+  std::vector<char> buf(msg_size);
+  std::vector<uint64_t> regular, wrapping;
+  for (int i = 0; i < num_msgs; i++) {
+    uint64_t cycles = *q.write_pointer >> 32;
+    uint64_t start = nanos_since_epoch();
+    send(&q, buf.data(), msg_size);
+    uint64_t t = nanos_since_epoch() - start;
+    ((*q.write_pointer >> 32) != cycles ? wrapping : regular).push_back(t);
+
+    msgq_msg_t msg;
+    msgq_msg_recv(&msg, &q_sub);
+    msgq_msg_close(&msg);
+  }
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+
+  char out[256];
+  snprintf(out, sizeof(out), "{\"size\": %zu, \"wraps\": %zu, \"send_p50_ns\": %.0f, \"wrapping_send_p50_ns\": %.0f}",
+           msg_size, wrapping.size(), percentile(regular, 0.5), percentile(wrapping, 0.5));
+  return out;
+}
+
+// The reader state access pattern of a queue, with the packed header layout from before MSGQ_VERSION 1
+// and with the current one. The packed header kept the write pointer next to num_readers and the reader
+// arrays, and the pointers, valid flags and uids of all readers in three arrays of eight byte entries.
+// Readers are pinned to their own cores, the publisher moves the write pointer and readers follow it.
+static std::string bench_layout(bool packed, int num_readers, int duration_ms) {
+  const int max_readers = DEFAULT_NUM_READERS;
+  std::vector<std::atomic<uint64_t>> words((2 + max_readers) * CACHE_LINE_SIZE / sizeof(uint64_t) + CACHE_LINE_SIZE);
+  // Start the header on a cache line
+  std::atomic<uint64_t> *header = words.data();
+  while ((uintptr_t)header % CACHE_LINE_SIZE != 0) header++;
+
+  const size_t line = CACHE_LINE_SIZE / sizeof(uint64_t);
+  std::atomic<uint64_t> *write_pointer = packed ? &header[1] : &header[line];
+  auto reader_word = [&](int i, int field) {
+    return packed ? &header[3 + field * max_readers + i] : &header[(2 + i) * line + field];
+  };
+
+  std::atomic<int> ready = 0;
+  std::atomic<bool> done = false;
+  std::vector<uint64_t> updates(num_readers);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < num_readers; i++) {
+    readers.emplace_back([&, i]() {
+      pin_to_core(i + 1);
+      std::atomic<uint64_t> *read_pointer = reader_word(i, 0), *read_valid = reader_word(i, 1);
+      *read_valid = 1;
+      ready++;
+
+      uint64_t n = 0;
+      while (!done) {
+        uint64_t wp = *write_pointer;
+        if (*read_pointer != wp && *read_valid) {
+          *read_pointer = wp;
+          n++;
+        }
+      }
+      updates[i] = n;
+    });
+  }
+
+  pin_to_core(0);
+  while (ready < num_readers) std::this_thread::yield();
+
+  // The publisher also goes over the reader pointers, like the overrun check on every send
+  uint64_t sends = 0, lag = 0;
+  uint64_t start = nanos_since_epoch();
+  uint64_t end = start + duration_ms * 1000000ULL;
+  while (nanos_since_epoch() < end) {
+    for (int j = 0; j < 100; j++) {
+      for (int i = 0; i < num_readers; i++) {
+        lag += sends - *reader_word(i, 0);
+      }
+      *write_pointer = ++sends;
+    }
+  }
+  double elapsed = (nanos_since_epoch() - start) / 1e9;
+  done = true;
+  for (auto &t : readers) t.join();
+
+  uint64_t total_updates = 0;
+  for (auto n : updates) total_updates += n;
+
+  char out[256];
+  snprintf(out, sizeof(out), "{\"layout\": \"%s\", \"readers\": %d, \"publish_per_s\": %.0f, \"reader_updates_per_s\": %.0f, \"mean_lag\": %.1f}",
+           packed ? "packed" : "cache_line", num_readers, sends / elapsed, total_updates / elapsed / num_readers,
+           (double)lag / sends / num_readers);
+  return out;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> latency;
+  for (size_t size : {64, 1024, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024}) {
+    latency.push_back(bench_latency(size, size > 1024 * 1024 ? 100 : 1000));
+  }
+
+  std::vector<std::string> throughput;
+  for (int readers = 1; readers <= 10; readers++) {
+    throughput.push_back(bench_throughput(readers, 100000, 64));
+  }
+
+  std::vector<std::string> conflate;
+  for (bool c : {false, true}) {
+    conflate.push_back(bench_conflate(c, 100, 1000));
+  }
+
+  std::vector<std::string> wraparound;
+  for (size_t size : {64, 4096}) {
+    wraparound.push_back(bench_wraparound(size, 100000));
+  }
+
+  std::vector<std::string> layout;
+  for (int readers : {1, 2, 4, 8}) {
+    for (bool packed : {true, false}) {
+      layout.push_back(bench_layout(packed, readers, 500));
+    }
+  }
+
+  printf("{\n");
+  printf("  \"latency\": %s,\n", join(latency).c_str());
+  printf("  \"throughput\": %s,\n", join(throughput).c_str());
+  printf("  \"conflate\": %s,\n", join(conflate).c_str());
+  printf("  \"wraparound\": %s,\n", join(wraparound).c_str());
+  printf("  \"layout\": %s\n", join(layout).c_str());
+  printf("}\n");
+  return 0;
+}
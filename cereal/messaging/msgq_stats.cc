@@ -0,0 +1,160 @@
+// Samples the statistics in the header of every msgq queue in /dev/shm, to find slow consumers.
+// Usage: msgq_stats [-i interval in seconds] [queue ...]
+//
+// For every queue it prints the publish rate, and for every reader how far it lags
+// behind the publisher and how often it was overrun during the interval.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "msgq.h"
+
+struct QueueSample {
+  uint64_t num_msgs, num_bytes, num_evictions;
+  std::vector<msgq_reader_t> readers;
+};
+
+struct Queue {
+  std::string name;
+  char *mem;
+  size_t mem_size;
+  msgq_header_t *header;
+  msgq_reader_t *readers;
+  size_t data_size;
+};
+
+static bool open_queue(const std::string &name, Queue &queue) {
+  int fd = open(("/dev/shm/" + name).c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  char *mem = (char *)MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size > sizeof(msgq_header_t)) {
+    mem = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) return false;
+
+  // Skip other files in /dev/shm, and queues from builds with a different layout
+  msgq_header_t *header = (msgq_header_t *)mem;
+  if (header->version != MSGQ_VERSION || !(header->flags & MSGQ_FLAGS_VALID) ||
+      MSGQ_HEADER_SIZE(header->max_readers) >= (size_t)st.st_size) {
+    munmap(mem, st.st_size);
+    return false;
+  }
+
+  queue = {name, mem, (size_t)st.st_size, header, (msgq_reader_t *)(mem + sizeof(msgq_header_t)),
+           st.st_size - MSGQ_HEADER_SIZE(header->max_readers)};
+  return true;
+}
+
+static QueueSample sample(const Queue &q) {
+  QueueSample s = {q.header->num_msgs, q.header->num_bytes, q.header->num_evictions};
+  s.readers.assign(q.readers, q.readers + std::min(q.header->num_readers, q.header->max_readers));
+  return s;
+}
+
+// Bytes the reader still has to read, or -1 if the publisher already lapped it
+static int64_t lag_bytes(uint64_t write_pointer, uint64_t read_pointer, size_t size) {
+  uint32_t write_cycles, write_offset, read_cycles, read_offset;
+  UNPACK64(write_cycles, write_offset, write_pointer);
+  UNPACK64(read_cycles, read_offset, read_pointer);
+
+  if (read_cycles == write_cycles) return write_offset - read_offset;
+  if (read_cycles + 1 == write_cycles && read_offset >= write_offset) return size - read_offset + write_offset;
+  return -1;
+}
+
+static std::string process_name(uint64_t uid) {
+  std::string name;
+  std::ifstream comm("/proc/" + std::to_string(uid & 0xFFFFFFFF) + "/comm");
+  std::getline(comm, name);
+  return name.empty() ? "?" : name;
+}
+
+int main(int argc, char *argv[]) {
+  double interval = 1.0;
+  std::vector<std::string> names;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-i" && i + 1 < argc) {
+      interval = atof(argv[++i]);
+    } else if (arg == "-h" || arg == "--help") {
+      printf("usage: %s [-i interval in seconds] [queue ...]\n", argv[0]);
+      return 0;
+    } else {
+      names.push_back(arg);
+    }
+  }
+
+  if (names.empty()) {
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL) {
+      perror("/dev/shm");
+      return 1;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+  }
+
+  std::vector<Queue> queues;
+  for (auto &name : names) {
+    Queue q;
+    if (open_queue(name, q)) queues.push_back(q);
+  }
+
+  std::vector<QueueSample> before;
+  for (auto &q : queues) before.push_back(sample(q));
+  auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-28s%-10s%10s%12s%14s%12s%10s\n", "queue", "mode", "msgs/s", "kB/s", "total msgs", "size kB", "evicted");
+  for (size_t i = 0; i < queues.size(); i++) {
+    const Queue &q = queues[i];
+    QueueSample s = sample(q);
+    const char *mode = (q.header->flags & MSGQ_FLAGS_LATEST_VALUE) ? "latest" :
+                       (q.header->flags & MSGQ_FLAGS_MULTIPLE_PUBLISHERS) ? "multi" : "single";
+    printf("%-28s%-10s%10.1f%12.1f%14lu%12zu%10lu\n", q.name.c_str(), mode,
+           (s.num_msgs - before[i].num_msgs) / elapsed, (s.num_bytes - before[i].num_bytes) / elapsed / 1024.,
+           (unsigned long)s.num_msgs, q.data_size / 1024, (unsigned long)(s.num_evictions - before[i].num_evictions));
+
+    // Readers of latest value queues aren't tracked
+    if (q.header->flags & MSGQ_FLAGS_LATEST_VALUE) continue;
+
+    for (size_t j = 0; j < s.readers.size(); j++) {
+      const msgq_reader_t &r = s.readers[j];
+      if (r.read_uid == 0) continue;
+
+      uint64_t overruns = r.read_overruns;
+      if (j < before[i].readers.size() && before[i].readers[j].read_uid == r.read_uid) {
+        overruns -= before[i].readers[j].read_overruns;
+      }
+
+      // A lapped reader skips ahead to the write pointer on its next read
+      int64_t lag = r.read_valid ? lag_bytes(q.header->write_pointer, r.read_pointer, q.data_size) : -1;
+      std::string lag_str = lag < 0 ? "lapped" : std::to_string(lag / 1024) + " kB (" + std::to_string(100 * lag / q.data_size) + "%)";
+      printf("  reader %-3zu pid %-8lu %-16s lag %-20s overruns %lu (total %lu)%s\n", j, (unsigned long)(r.read_uid & 0xFFFFFFFF),
+             process_name(r.read_uid).c_str(), lag_str.c_str(), (unsigned long)overruns, (unsigned long)r.read_overruns,
+             overruns > 0 ? "  <-- too slow" : "");
+    }
+  }
+
+  for (auto &q : queues) munmap(q.mem, q.mem_size);
+  return 0;
+}
@@ -0,0 +1,970 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <vector>
+
+#include <poll.h>
+
+#include "catch2/catch.hpp"
+#include "msgq.h"
+#include "sim_clock.h"
+
+TEST_CASE("ALIGN"){
+  REQUIRE(ALIGN(0) == 0);
+  REQUIRE(ALIGN(1) == 8);
+  REQUIRE(ALIGN(7) == 8);
+  REQUIRE(ALIGN(8) == 8);
+  REQUIRE(ALIGN(99999) == 100000);
+}
+
+TEST_CASE("msgq_msg_init_size"){
+  const size_t msg_size = 30;
+  msgq_msg_t msg;
+
+  msgq_msg_init_size(&msg, msg_size);
+  REQUIRE(msg.size == msg_size);
+
+  msgq_msg_close(&msg);
+}
+
+TEST_CASE("msgq_msg_init_data"){
+  const size_t msg_size = 30;
+  char * data = new char[msg_size];
+
+  for (size_t i = 0; i < msg_size; i++){
+    data[i] = i;
+  }
+
+  msgq_msg_t msg;
+  msgq_msg_init_data(&msg, data, msg_size);
+
+  REQUIRE(msg.size == msg_size);
+  REQUIRE(memcmp(msg.data, data, msg_size) == 0);
+
+  delete[] data;
+  msgq_msg_close(&msg);
+}
+
+TEST_CASE("Send and receive"){
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, "test_queue", 1024) == 0);
+  msgq_init_publisher(&q);
+
+  msgq_queue_t q_sub;
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue", 1024) == 0);
+  msgq_init_subscriber(&q_sub);
+
+  msgq_msg_t msg_recv;
+  REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == 0);
+
+  for (uint64_t i = 0; i < 100; i++){
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&i, sizeof(i));
+    REQUIRE(msgq_msg_send(&msg, &q) == sizeof(i));
+    msgq_msg_close(&msg);
+
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == sizeof(i));
+    REQUIRE(*(uint64_t*)msg_recv.data == i);
+    msgq_msg_close(&msg_recv);
+  }
+
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Poll times out without messages"){
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, "test_queue", 1024) == 0);
+  msgq_init_publisher(&q);
+
+  msgq_queue_t q_sub;
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue", 1024) == 0);
+  msgq_init_subscriber(&q_sub);
+
+  msgq_pollitem_t item = {.q = &q_sub};
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(msgq_poll(&item, 1, 50) == 0);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  REQUIRE(elapsed >= std::chrono::milliseconds(50));
+
+  REQUIRE(msgq_poll(&item, 1, 0) == 0);
+
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Poll is woken up by publisher"){
+  msgq_queue_t q1, q2;
+  REQUIRE(msgq_new_queue(&q1, "test_queue", 1024) == 0);
+  REQUIRE(msgq_new_queue(&q2, "test_queue_2", 1024) == 0);
+  msgq_init_publisher(&q1);
+  msgq_init_publisher(&q2);
+
+  msgq_queue_t q1_sub, q2_sub;
+  REQUIRE(msgq_new_queue(&q1_sub, "test_queue", 1024) == 0);
+  REQUIRE(msgq_new_queue(&q2_sub, "test_queue_2", 1024) == 0);
+  msgq_init_subscriber(&q1_sub);
+  msgq_init_subscriber(&q2_sub);
+
+  msgq_pollitem_t items[2] = {{.q = &q1_sub}, {.q = &q2_sub}};
+
+  std::thread publisher([&]{
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint64_t data = 1234;
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&data, sizeof(data));
+    msgq_msg_send(&msg, &q2);
+    msgq_msg_close(&msg);
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(msgq_poll(items, 2, 10000) == 1);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  publisher.join();
+
+  // Woken up by the message, not by the timeout
+  REQUIRE(elapsed < std::chrono::milliseconds(1000));
+  REQUIRE(items[0].revents == 0);
+  REQUIRE(items[1].revents == 1);
+
+  msgq_close_queue(&q1_sub);
+  msgq_close_queue(&q2_sub);
+  msgq_close_queue(&q1);
+  msgq_close_queue(&q2);
+}
+
+TEST_CASE("File descriptor is readable when a message is sent"){
+  msgq_queue_t q, q_sub;
+  REQUIRE(msgq_new_queue(&q, "test_queue", 1024) == 0);
+  msgq_init_publisher(&q);
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue", 1024) == 0);
+  msgq_init_subscriber(&q_sub);
+
+  struct pollfd pfd = {.fd = msgq_get_fd(&q_sub), .events = POLLIN};
+  REQUIRE(pfd.fd >= 0);
+  REQUIRE(msgq_get_fd(&q_sub) == pfd.fd);
+
+  // Readable once at the start, receiving clears it
+  REQUIRE(poll(&pfd, 1, 1000) == 1);
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &q_sub) == 0);
+  REQUIRE(poll(&pfd, 1, 0) == 0);
+
+  std::thread publisher([&]{
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint64_t data = 1234;
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&data, sizeof(data));
+    msgq_msg_send(&msg, &q);
+    msgq_msg_close(&msg);
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(poll(&pfd, 1, 10000) == 1);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  publisher.join();
+  REQUIRE(elapsed < std::chrono::milliseconds(1000));
+
+  REQUIRE(msgq_msg_recv(&msg, &q_sub) == sizeof(uint64_t));
+  REQUIRE(*(uint64_t*)msg.data == 1234);
+  msgq_msg_close(&msg);
+
+  REQUIRE(msgq_msg_recv(&msg, &q_sub) == 0);
+  REQUIRE(poll(&pfd, 1, 0) == 0);
+
+  // A reader that reconnects after a new publisher took over keeps waking the bridge
+  uint64_t bridge_slot = *q.read_notify[q_sub.reader_id];
+  msgq_init_publisher(&q);
+  REQUIRE(msgq_msg_recv(&msg, &q_sub) == 0);
+  REQUIRE(q_sub.reader_id >= 0);
+  REQUIRE(*q.read_notify[q_sub.reader_id] == bridge_slot);
+
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Borrow and release"){
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, "test_queue", 1024) == 0);
+  msgq_init_publisher(&q);
+
+  msgq_queue_t q_sub;
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue", 1024) == 0);
+  msgq_init_subscriber(&q_sub);
+
+  uint64_t data = 1234;
+  msgq_msg_t msg;
+  msgq_msg_init_data(&msg, (char*)&data, sizeof(data));
+  msgq_msg_send(&msg, &q);
+
+  SECTION("Valid message"){
+    msgq_msg_t msg_borrowed;
+    REQUIRE(msgq_msg_borrow(&msg_borrowed, &q_sub) == sizeof(data));
+    REQUIRE(msg_borrowed.data >= q_sub.data);
+    REQUIRE(msg_borrowed.data < q_sub.data + q_sub.size);
+    REQUIRE((uintptr_t)msg_borrowed.data % 8 == 0);
+    REQUIRE(*(uint64_t*)msg_borrowed.data == data);
+    REQUIRE(msgq_msg_release(&q_sub) == 0);
+
+    // Message is consumed after release
+    REQUIRE(msgq_msg_borrow(&msg_borrowed, &q_sub) == 0);
+  }
+
+  SECTION("Overwritten message"){
+    msgq_msg_t msg_borrowed;
+    REQUIRE(msgq_msg_borrow(&msg_borrowed, &q_sub) == sizeof(data));
+
+    // Wrap around the whole queue while the message is borrowed
+    for (int i = 0; i < 100; i++){
+      msgq_msg_send(&msg, &q);
+    }
+
+    REQUIRE(msgq_msg_release(&q_sub) == -1);
+  }
+
+  msgq_msg_close(&msg);
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Reserve and commit"){
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, "test_queue", 1024) == 0);
+  msgq_init_publisher(&q);
+
+  msgq_queue_t q_sub;
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue", 1024) == 0);
+  msgq_init_subscriber(&q_sub);
+
+  for (uint64_t i = 0; i < 100; i++){
+    char *p = msgq_msg_reserve(&q, sizeof(i));
+    REQUIRE(p != NULL);
+    REQUIRE((uintptr_t)p % 8 == 0);
+    *(uint64_t*)p = i;
+
+    // Not visible to readers before it is committed
+    msgq_msg_t msg_recv;
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == 0);
+    REQUIRE(msgq_msg_commit(&q) == sizeof(i));
+
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == sizeof(i));
+    REQUIRE(*(uint64_t*)msg_recv.data == i);
+    msgq_msg_close(&msg_recv);
+  }
+
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Conflate"){
+  uint64_t flags = GENERATE((uint64_t)0, MSGQ_FLAGS_MULTIPLE_PUBLISHERS);
+  const char *name = flags ? "test_queue_conflate_multi" : "test_queue_conflate";
+
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, name, 1024, DEFAULT_NUM_READERS, flags) == 0);
+  msgq_init_publisher(&q);
+
+  msgq_queue_t q_sub;
+  REQUIRE(msgq_new_queue(&q_sub, name, 1024, DEFAULT_NUM_READERS, flags) == 0);
+  msgq_init_subscriber(&q_sub);
+  q_sub.read_conflate = true;
+
+  // Different numbers of messages in between reads, including enough to wrap around
+  uint64_t sent = 0;
+  for (int iter = 1; iter < 30; iter++){
+    for (int i = 0; i < iter; i++){
+      msgq_msg_t msg;
+      msgq_msg_init_data(&msg, (char*)&sent, sizeof(sent));
+      msgq_msg_send(&msg, &q);
+      msgq_msg_close(&msg);
+      sent++;
+    }
+
+    msgq_msg_t msg_recv;
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == sizeof(sent));
+    REQUIRE(*(uint64_t*)msg_recv.data == sent - 1);
+    msgq_msg_close(&msg_recv);
+
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == 0);
+    REQUIRE(*q_sub.read_pointers[q_sub.reader_id] == *q.write_pointer);
+  }
+
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Statistics"){
+  msgq_queue_t q, q_sub;
+  REQUIRE(msgq_new_queue(&q, "test_queue_stats", 1024) == 0);
+  msgq_init_publisher(&q);
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue_stats", 1024) == 0);
+  msgq_init_subscriber(&q_sub);
+
+  uint64_t num_msgs = *q.num_msgs, num_bytes = *q.num_bytes;
+  REQUIRE(*q.read_overruns[q_sub.reader_id] == 0);
+
+  // Lap the reader, that's one overrun no matter how many messages it missed
+  char data[64] = {};
+  for (int i = 0; i < 100; i++){
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, data, sizeof(data));
+    msgq_msg_send(&msg, &q);
+    msgq_msg_close(&msg);
+  }
+  REQUIRE(*q.num_msgs == num_msgs + 100);
+  REQUIRE(*q.num_bytes == num_bytes + 100 * sizeof(data));
+  REQUIRE(*q.read_overruns[q_sub.reader_id] == 1);
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &q_sub) == 0);
+  REQUIRE(*q.read_overruns[q_sub.reader_id] == 1);
+
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Reader slots"){
+  const size_t max_readers = 4;
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, "test_queue_readers", 1024, max_readers) == 0);
+  msgq_init_publisher(&q);
+  REQUIRE(q.max_readers == max_readers);
+
+  msgq_queue_t readers[max_readers];
+  for (size_t i = 0; i < max_readers; i++){
+    REQUIRE(msgq_new_queue(&readers[i], "test_queue_readers", 1024, max_readers) == 0);
+    REQUIRE(msgq_init_subscriber(&readers[i]) == 0);
+    REQUIRE(readers[i].reader_id == (int)i);
+  }
+
+  SECTION("Live readers are never evicted"){
+    msgq_queue_t extra;
+    REQUIRE(msgq_new_queue(&extra, "test_queue_readers", 1024, max_readers) == 0);
+    REQUIRE(msgq_init_subscriber(&extra) == -1);
+
+    for (size_t i = 0; i < max_readers; i++){
+      REQUIRE(*readers[i].read_uids[i] == readers[i].read_uid_local);
+    }
+    msgq_close_queue(&extra);
+  }
+
+  SECTION("Closed reader frees its slot"){
+    msgq_close_queue(&readers[1]);
+
+    REQUIRE(msgq_new_queue(&readers[1], "test_queue_readers", 1024, max_readers) == 0);
+    REQUIRE(msgq_init_subscriber(&readers[1]) == 0);
+    REQUIRE(readers[1].reader_id == 1);
+  }
+
+  SECTION("Dead reader is evicted"){
+    // Pretend the process that owns slot 2 is gone
+    uint64_t dead_uid = (readers[2].read_uid_local & 0xFFFFFFFF00000000) | 0x7FFFFFFF;
+    *q.read_uids[2] = dead_uid;
+
+    uint64_t evictions = *q.num_evictions;
+    msgq_queue_t extra;
+    REQUIRE(msgq_new_queue(&extra, "test_queue_readers", 1024, max_readers) == 0);
+    REQUIRE(msgq_init_subscriber(&extra) == 0);
+    REQUIRE(extra.reader_id == 2);
+    REQUIRE(*q.num_evictions == evictions + 1);
+    msgq_close_queue(&extra);
+  }
+
+  SECTION("Reader without a free slot retries later"){
+    // A new publisher takes the slots away, and other readers grab them before reader 0 notices
+    uint64_t evictions = *q.num_evictions;
+    msgq_init_publisher(&q);
+    msgq_queue_t others[max_readers];
+    for (size_t i = 0; i < max_readers; i++){
+      REQUIRE(msgq_new_queue(&others[i], "test_queue_readers", 1024, max_readers) == 0);
+      REQUIRE(msgq_init_subscriber(&others[i]) == 0);
+    }
+
+    REQUIRE(msgq_msg_ready(&readers[0]) == 0);
+    REQUIRE(readers[0].reader_id == -1);
+
+    // The freed slot is only picked up after the retry interval
+    msgq_close_queue(&others[2]);
+    REQUIRE(msgq_msg_ready(&readers[0]) == 0);
+    REQUIRE(readers[0].reader_id == -1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(MSGQ_RECONNECT_MS + 10));
+    REQUIRE(msgq_msg_ready(&readers[0]) == 0);
+    REQUIRE(readers[0].reader_id == 2);
+
+    // Only dead readers count as evicted
+    REQUIRE(*q.num_evictions == evictions);
+
+    for (size_t i = 0; i < max_readers; i++){
+      if (i != 2) msgq_close_queue(&others[i]);
+    }
+  }
+
+  SECTION("Reader slot count is decided by the first opener"){
+    msgq_queue_t other;
+    REQUIRE(msgq_new_queue(&other, "test_queue_readers", 1024, 2 * max_readers) == 0);
+    REQUIRE(other.max_readers == max_readers);
+    REQUIRE(other.data == other.mmap_p + MSGQ_HEADER_SIZE(max_readers));
+    msgq_close_queue(&other);
+  }
+
+  for (size_t i = 0; i < max_readers; i++){
+    msgq_close_queue(&readers[i]);
+  }
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Header layout"){
+  const size_t max_readers = 4;
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, "test_queue_layout", 1024, max_readers) == 0);
+
+  auto line = [&](void *p){ return ((char*)p - q.mmap_p) / CACHE_LINE_SIZE; };
+
+  // The publisher and every reader write to their own cache line
+  REQUIRE(line(q.write_pointer) != line(q.num_readers));
+  for (size_t i = 0; i < max_readers; i++){
+    REQUIRE(line(q.read_pointers[i]) == line(q.read_valids[i]));
+    REQUIRE(line(q.read_pointers[i]) == line(q.read_uids[i]));
+    REQUIRE(line(q.read_pointers[i]) == line(q.read_notify[i]));
+    REQUIRE(line(q.read_pointers[i]) > line(q.write_pointer));
+    if (i > 0){
+      REQUIRE(line(q.read_pointers[i]) == line(q.read_pointers[i - 1]) + 1);
+    }
+  }
+  REQUIRE((q.data - q.mmap_p) % CACHE_LINE_SIZE == 0);
+  REQUIRE(((msgq_header_t*)q.mmap_p)->version == MSGQ_VERSION);
+
+  SECTION("Queue with a different layout is recreated"){
+    ((msgq_header_t*)q.mmap_p)->version = MSGQ_VERSION + 1;
+
+    msgq_queue_t other;
+    REQUIRE(msgq_new_queue(&other, "test_queue_layout", 1024, max_readers) == 0);
+    REQUIRE(((msgq_header_t*)other.mmap_p)->version == MSGQ_VERSION);
+    msgq_close_queue(&other);
+  }
+
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Borrow batch"){
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, "test_queue", 1024) == 0);
+  msgq_init_publisher(&q);
+
+  msgq_queue_t q_sub;
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue", 1024) == 0);
+  msgq_init_subscriber(&q_sub);
+
+  msgq_msg_t msgs[10];
+  REQUIRE(msgq_msg_borrow_batch(msgs, 10, 1024, &q_sub) == 0);
+
+  // Enough messages to wrap around the queue in between
+  uint64_t sent = 0, received = 0;
+  for (int iter = 0; iter < 20; iter++){
+    for (int i = 0; i < 7; i++){
+      msgq_msg_t msg;
+      msgq_msg_init_data(&msg, (char*)&sent, sizeof(sent));
+      msgq_msg_send(&msg, &q);
+      msgq_msg_close(&msg);
+      sent++;
+    }
+
+    // Alternate between hitting the message and the byte limit first
+    size_t max_msgs = (iter % 2) ? 10 : 5;
+    size_t max_bytes = (iter % 2) ? 3 * sizeof(uint64_t) : 1024;
+
+    int n = msgq_msg_borrow_batch(msgs, max_msgs, max_bytes, &q_sub);
+    REQUIRE(n == ((iter % 2) ? 3 : 5));
+    for (int i = 0; i < n; i++){
+      REQUIRE(*(uint64_t*)msgs[i].data == received++);
+    }
+    REQUIRE(msgq_msg_release(&q_sub) == 0);
+
+    n = msgq_msg_borrow_batch(msgs, 10, 1024, &q_sub);
+    REQUIRE(n == ((iter % 2) ? 4 : 2));
+    for (int i = 0; i < n; i++){
+      REQUIRE(*(uint64_t*)msgs[i].data == received++);
+    }
+    REQUIRE(msgq_msg_release(&q_sub) == 0);
+
+    REQUIRE(msgq_msg_borrow_batch(msgs, 10, 1024, &q_sub) == 0);
+  }
+
+  msgq_close_queue(&q_sub);
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Multiple publishers"){
+  msgq_queue_t pub[2];
+  for (auto &q : pub){
+    REQUIRE(msgq_new_queue(&q, "test_queue_multi", 1024, DEFAULT_NUM_READERS, MSGQ_FLAGS_MULTIPLE_PUBLISHERS) == 0);
+    REQUIRE(q.multiple_publishers);
+    msgq_init_publisher(&q);
+  }
+
+  msgq_queue_t q_sub;
+  REQUIRE(msgq_new_queue(&q_sub, "test_queue_multi", 1024, DEFAULT_NUM_READERS, MSGQ_FLAGS_MULTIPLE_PUBLISHERS) == 0);
+  REQUIRE(q_sub.multiple_publishers);
+  msgq_init_subscriber(&q_sub);
+
+  msgq_msg_t msg_recv;
+  for (uint64_t i = 0; i < 100; i++){
+    // Committed out of order, read in the order the space was reserved
+    char *p0 = msgq_msg_reserve(&pub[0], sizeof(i));
+    char *p1 = msgq_msg_reserve(&pub[1], sizeof(i));
+    REQUIRE(p0 != NULL);
+    REQUIRE(p1 != NULL);
+    *(uint64_t*)p0 = 2 * i;
+    *(uint64_t*)p1 = 2 * i + 1;
+
+    REQUIRE(msgq_msg_commit(&pub[1]) == sizeof(i));
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == 0);
+
+    REQUIRE(msgq_msg_commit(&pub[0]) == sizeof(i));
+    for (uint64_t j = 0; j < 2; j++){
+      REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == sizeof(i));
+      REQUIRE(*(uint64_t*)msg_recv.data == 2 * i + j);
+      msgq_msg_close(&msg_recv);
+    }
+  }
+
+  SECTION("Message of a dead publisher is skipped"){
+    uint64_t data = 1234;
+    REQUIRE(msgq_msg_reserve(&pub[0], sizeof(data)) != NULL);
+
+    // Pretend the process that reserved the message is gone
+    uint32_t ptr = pub[0].reserved_pointer & 0xFFFFFFFF;
+    *(int64_t*)(pub[0].data + ptr) = MSGQ_TAG_PENDING | 0x3FFFFFULL << 32 | sizeof(data);
+    pub[0].reserved_size = 0;
+
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&data, sizeof(data));
+    REQUIRE(msgq_msg_send(&msg, &pub[1]) == sizeof(data));
+    msgq_msg_close(&msg);
+
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == sizeof(data));
+    REQUIRE(*(uint64_t*)msg_recv.data == data);
+    msgq_msg_close(&msg_recv);
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == 0);
+  }
+
+  SECTION("Concurrent publishers"){
+    const int num_threads = 4;
+    const uint64_t num_msgs = 10000;
+
+    std::atomic<int> finished = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++){
+      threads.emplace_back([t, num_msgs, &finished](){
+        msgq_queue_t q;
+        msgq_new_queue(&q, "test_queue_multi", 1024, DEFAULT_NUM_READERS, MSGQ_FLAGS_MULTIPLE_PUBLISHERS);
+        msgq_init_publisher(&q);
+
+        for (uint64_t i = 0; i < num_msgs; i++){
+          uint64_t data[2] = {(uint64_t)t, i};
+          msgq_msg_t msg;
+          msgq_msg_init_data(&msg, (char*)data, sizeof(data));
+          msgq_msg_send(&msg, &q);
+          msgq_msg_close(&msg);
+        }
+        msgq_close_queue(&q);
+        finished++;
+      });
+    }
+
+    // The queue is small, so the reader gets invalidated and drops messages.
+    // Whatever it does read has to be in order per publisher.
+    std::vector<int64_t> last(num_threads, -1);
+    while (true){
+      bool all_finished = finished == num_threads;
+      if (msgq_msg_recv(&msg_recv, &q_sub) > 0){
+        REQUIRE(msg_recv.size == 2 * sizeof(uint64_t));
+        uint64_t *data = (uint64_t*)msg_recv.data;
+        REQUIRE(data[0] < (uint64_t)num_threads);
+        REQUIRE((int64_t)data[1] > last[data[0]]);
+        last[data[0]] = data[1];
+        msgq_msg_close(&msg_recv);
+      } else if (all_finished){
+        break;
+      }
+    }
+
+    for (auto &t : threads) t.join();
+
+    // Everything was committed and the queue still works
+    REQUIRE(*q_sub.write_pointer == *q_sub.reserve_pointer);
+
+    uint64_t data = 1234;
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&data, sizeof(data));
+    REQUIRE(msgq_msg_send(&msg, &pub[0]) == sizeof(data));
+    msgq_msg_close(&msg);
+
+    REQUIRE(msgq_msg_recv(&msg_recv, &q_sub) == sizeof(data));
+    REQUIRE(*(uint64_t*)msg_recv.data == data);
+    msgq_msg_close(&msg_recv);
+  }
+
+  msgq_close_queue(&q_sub);
+  for (auto &q : pub){
+    msgq_close_queue(&q);
+  }
+}
+
+TEST_CASE("Latest value"){
+  const char *name = "test_queue_latest";
+  const size_t size = 4096;
+  // Start without subscribers left behind by an earlier run that crashed
+  unlink("/dev/shm/test_queue_latest");
+
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+  msgq_init_publisher(&q);
+  REQUIRE(q.latest_value);
+
+  auto send = [&](uint64_t value, size_t len = sizeof(uint64_t)){
+    std::vector<uint64_t> data(len / sizeof(uint64_t), value);
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)data.data(), len);
+    msgq_msg_send(&msg, &q);
+    msgq_msg_close(&msg);
+  };
+
+  SECTION("Readers only get the newest message"){
+    // More readers than a regular queue has slots
+    std::vector<msgq_queue_t> subs(2 * DEFAULT_NUM_READERS);
+    for (auto &q_sub : subs){
+      REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+      REQUIRE(msgq_init_subscriber(&q_sub) == 0);
+    }
+
+    for (uint64_t i = 0; i < 10; i++){
+      send(i);
+    }
+
+    for (auto &q_sub : subs){
+      REQUIRE(msgq_msg_ready(&q_sub));
+      msgq_msg_t msg;
+      REQUIRE(msgq_msg_recv(&msg, &q_sub) == sizeof(uint64_t));
+      REQUIRE(*(uint64_t*)msg.data == 9);
+      msgq_msg_close(&msg);
+
+      REQUIRE(!msgq_msg_ready(&q_sub));
+      REQUIRE(msgq_msg_recv(&msg, &q_sub) == 0);
+      msgq_close_queue(&q_sub);
+    }
+  }
+
+  SECTION("Borrowed message is invalidated when its slot is reused"){
+    msgq_queue_t q_sub;
+    REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    msgq_init_subscriber(&q_sub);
+
+    send(1);
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_borrow(&msg, &q_sub) == sizeof(uint64_t));
+    REQUIRE(*(uint64_t*)msg.data == 1);
+
+    // The next message goes into the other slot
+    send(2);
+    REQUIRE(msgq_msg_release(&q_sub) == 0);
+
+    REQUIRE(msgq_msg_borrow(&msg, &q_sub) == sizeof(uint64_t));
+    send(3);
+    send(4);
+    REQUIRE(msgq_msg_release(&q_sub) == -1);
+
+    msgq_close_queue(&q_sub);
+  }
+
+  SECTION("Poll is woken up by publisher"){
+    msgq_queue_t q_sub;
+    REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    msgq_init_subscriber(&q_sub);
+
+    std::thread publisher([&]{
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      send(1234);
+    });
+
+    msgq_pollitem_t item = {.q = &q_sub};
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(msgq_poll(&item, 1, 10000) == 1);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1000));
+    publisher.join();
+
+    msgq_close_queue(&q_sub);
+  }
+
+  SECTION("Publisher that died while writing"){
+    msgq_queue_t q_sub;
+    REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    msgq_init_subscriber(&q_sub);
+
+    // A reader doesn't spin on a slot that never finishes
+    send(1);
+    q.latest->slots[*q.write_pointer % 2].seq++;
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &q_sub) == 0);
+    q.latest->slots[*q.write_pointer % 2].seq++;
+
+    // The next publisher takes over in the middle of a message
+    REQUIRE(msgq_msg_reserve(&q, sizeof(uint64_t)) != NULL);
+    msgq_queue_t q_pub;
+    REQUIRE(msgq_new_queue(&q_pub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    msgq_init_publisher(&q_pub);
+
+    for (uint64_t i = 2; i < 5; i++){
+      uint64_t data = i;
+      msgq_msg_init_data(&msg, (char*)&data, sizeof(data));
+      msgq_msg_send(&msg, &q_pub);
+      msgq_msg_close(&msg);
+
+      REQUIRE(msgq_msg_recv(&msg, &q_sub) == sizeof(uint64_t));
+      REQUIRE(*(uint64_t*)msg.data == i);
+      msgq_msg_close(&msg);
+    }
+
+    msgq_close_queue(&q_pub);
+    msgq_close_queue(&q_sub);
+  }
+
+  SECTION("Publisher clears the wake mask"){
+    msgq_queue_t q_sub;
+    REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    msgq_init_subscriber(&q_sub);
+
+    msgq_pollitem_t item = {.q = &q_sub};
+    REQUIRE(msgq_poll(&item, 1, 10) == 0);
+    msgq_close_queue(&q_sub);
+
+    // The closed poller's bit is gone after the next message
+    send(1);
+    for (uint64_t mask : q.latest->wake_mask){
+      REQUIRE(mask == 0);
+    }
+  }
+
+  SECTION("All readers updated"){
+    REQUIRE(!msgq_all_readers_updated(&q));
+
+    msgq_queue_t subs[2];
+    for (auto &q_sub : subs){
+      REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+      REQUIRE(msgq_init_subscriber(&q_sub) == 0);
+    }
+    REQUIRE(msgq_all_readers_updated(&q));
+
+    send(1);
+    send(2);
+    REQUIRE(!msgq_all_readers_updated(&q));
+
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &subs[0]) == sizeof(uint64_t));
+    msgq_msg_close(&msg);
+    REQUIRE(!msgq_all_readers_updated(&q));
+
+    REQUIRE(msgq_msg_borrow(&msg, &subs[1]) == sizeof(uint64_t));
+    REQUIRE(msgq_msg_release(&subs[1]) == 0);
+    REQUIRE(msgq_all_readers_updated(&q));
+
+    // A new reader is up to date with the message that was sent before it
+    msgq_queue_t late;
+    REQUIRE(msgq_new_queue(&late, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    REQUIRE(msgq_init_subscriber(&late) == 0);
+    REQUIRE(msgq_all_readers_updated(&q));
+
+    // Closed readers don't hold the publisher up
+    send(3);
+    msgq_close_queue(&subs[1]);
+    msgq_close_queue(&late);
+    REQUIRE(msgq_msg_recv(&msg, &subs[0]) == sizeof(uint64_t));
+    msgq_msg_close(&msg);
+    REQUIRE(msgq_all_readers_updated(&q));
+
+    msgq_close_queue(&subs[0]);
+  }
+
+  SECTION("Dead subscriber is reaped"){
+    msgq_queue_t subs[2];
+    for (auto &q_sub : subs){
+      REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+      REQUIRE(msgq_init_subscriber(&q_sub) == 0);
+    }
+
+    // Pretend the process of the second subscriber is gone
+    uint64_t dead_uid = (subs[1].read_uid_local & 0xFFFFFFFF00000000) | 0x7FFFFFFF;
+    q.latest->subscribers[subs[1].latest_subscriber_id] = dead_uid;
+
+    send(1);
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &subs[0]) == sizeof(uint64_t));
+    msgq_msg_close(&msg);
+
+    uint64_t evictions = *q.num_evictions;
+    REQUIRE(msgq_all_readers_updated(&q));
+    REQUIRE(q.latest->subscribers[subs[1].latest_subscriber_id] == 0);
+    REQUIRE(*q.num_evictions == evictions + 1);
+
+    // Its slot is free for the next subscriber
+    msgq_queue_t late;
+    REQUIRE(msgq_new_queue(&late, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    REQUIRE(msgq_init_subscriber(&late) == 0);
+    REQUIRE(late.latest_subscriber_id == subs[1].latest_subscriber_id);
+
+    msgq_close_queue(&late);
+    for (auto &q_sub : subs){
+      msgq_close_queue(&q_sub);
+    }
+  }
+
+  SECTION("Concurrent reads are never torn"){
+    std::atomic<bool> done = false;
+    std::thread publisher([&]{
+      for (uint64_t i = 1; i <= 100000; i++){
+        send(i, sizeof(uint64_t) * (1 + i % (q.latest_slot_size / sizeof(uint64_t))));
+      }
+      done = true;
+    });
+
+    msgq_queue_t q_sub;
+    REQUIRE(msgq_new_queue(&q_sub, name, size, DEFAULT_NUM_READERS, MSGQ_FLAGS_LATEST_VALUE) == 0);
+    msgq_init_subscriber(&q_sub);
+
+    uint64_t last = 0;
+    bool torn = false, ordered = true;
+    while (!done){
+      msgq_msg_t msg;
+      if (msgq_msg_recv(&msg, &q_sub) > 0){
+        uint64_t *data = (uint64_t*)msg.data;
+        size_t len = msg.size / sizeof(uint64_t);
+        torn |= len != 1 + data[0] % (q.latest_slot_size / sizeof(uint64_t));
+        for (size_t i = 1; i < len; i++){
+          torn |= data[i] != data[0];
+        }
+        ordered &= data[0] > last;
+        last = data[0];
+        msgq_msg_close(&msg);
+      }
+    }
+    publisher.join();
+
+    REQUIRE(!torn);
+    REQUIRE(ordered);
+    msgq_close_queue(&q_sub);
+  }
+
+  msgq_close_queue(&q);
+}
+
+TEST_CASE("Simulated clock"){
+  const char *path = "/dev/shm/test_sim_clock";
+  unlink(path);
+  sim_clock_t *c = sim_clock_open(path);
+  REQUIRE(c != nullptr);
+  const uint64_t start = c->nanos;
+  uint64_t next_deadline;
+
+  // Steps to the next deadline once the participant is idle
+  auto drive = [&](std::atomic<bool> &done){
+    int steps = 0;
+    auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done && std::chrono::steady_clock::now() < timeout){
+      uint64_t epoch = c->epoch;
+      if (sim_clock_all_idle(c, &next_deadline) && c->epoch == epoch && next_deadline != UINT64_MAX){
+        sim_clock_step(c, next_deadline, 10 * 1000000ULL);
+        steps++;
+      }
+      std::this_thread::yield();
+    }
+    return steps;
+  };
+
+  SECTION("Wakes up at the deadline"){
+    std::atomic<bool> done = false;
+    uint64_t woke_at = 0;
+    std::thread participant([&](){
+      sim_clock_wait_until(c, start + 35 * 1000000ULL);
+      woke_at = c->nanos;
+      done = true;
+    });
+
+    int steps = drive(done);
+    participant.join();
+
+    // Steps of at most 10 ms, the last one lands on the deadline
+    REQUIRE(woke_at == start + 35 * 1000000ULL);
+    REQUIRE(steps == 4);
+  }
+
+  SECTION("Wakes up on an event"){
+    std::atomic<bool> done = false, event = false;
+    std::thread participant([&](){
+      sim_clock_wait_until(c, UINT64_MAX, [&](){ return event.load(); });
+      done = true;
+    });
+
+    while (!(sim_clock_all_idle(c, &next_deadline) && next_deadline == UINT64_MAX)){
+      std::this_thread::yield();
+    }
+    event = true;
+    participant.join();
+    REQUIRE(done);
+    REQUIRE(c->nanos == start);
+  }
+
+  SECTION("Poll is woken up by publisher"){
+    msgq_queue_t q, q_sub;
+    REQUIRE(msgq_new_queue(&q, "test_queue", 1024) == 0);
+    REQUIRE(msgq_new_queue(&q_sub, "test_queue", 1024) == 0);
+    q.sim_clock = q_sub.sim_clock = c;
+    msgq_init_publisher(&q);
+    msgq_init_subscriber(&q_sub);
+
+    int num = 0;
+    std::chrono::steady_clock::time_point received;
+    std::thread subscriber([&](){
+      msgq_pollitem_t item = {.q = &q_sub};
+      num = msgq_poll(&item, 1, 1000);
+      received = std::chrono::steady_clock::now();
+    });
+
+    // Send once the subscriber waits on the clock, which doesn't step
+    while (!(sim_clock_all_idle(c, &next_deadline) && next_deadline != UINT64_MAX)){
+      std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    uint64_t data = 1234;
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&data, sizeof(data));
+    auto sent = std::chrono::steady_clock::now();
+    msgq_msg_send(&msg, &q);
+    msgq_msg_close(&msg);
+    subscriber.join();
+
+    REQUIRE(num == 1);
+    REQUIRE(c->nanos == start);
+    REQUIRE(received - sent < std::chrono::milliseconds(20));
+
+    msgq_close_queue(&q_sub);
+    msgq_close_queue(&q);
+  }
+
+  SECTION("Participant slot is freed when the thread exits"){
+    std::thread participant([&](){
+      sim_clock_wait_until(c, start);
+    });
+    participant.join();
+
+    REQUIRE(sim_clock_all_idle(c, &next_deadline));
+    for (auto &p : c->participants){
+      REQUIRE(p.uid == 0);
+    }
+  }
+
+  munmap(c, sizeof(sim_clock_t));
+  unlink(path);
+}
@@ -0,0 +1,179 @@
+// Drives the simulated clock, see sim_clock.h. Start it before the processes, all with SIM_CLOCK=1.
+// Usage: sim_clock [-n participants] [-s max step in ms] [-t timeout in ms] [-d duration in seconds]
+//
+// The clock advances to the earliest deadline of the participants once they are all idle and every
+// subscriber of a msgq queue read all messages, but by at most the max step. If something keeps
+// running or a subscriber doesn't read for longer than the timeout, the clock is stepped anyway.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "msgq.h"
+#include "sim_clock.h"
+
+static volatile sig_atomic_t do_exit = 0;
+
+static void sig_handler(int sig) {
+  do_exit = 1;
+}
+
+struct Queue {
+  std::string name;
+  char *mem;
+  size_t mem_size;
+  msgq_header_t *header;
+  msgq_reader_t *readers;
+};
+
+static std::vector<Queue> open_queues() {
+  std::vector<Queue> queues;
+  DIR *dir = opendir("/dev/shm");
+  if (dir == NULL) return queues;
+
+  while (struct dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    int fd = open(("/dev/shm/" + name).c_str(), O_RDONLY);
+    if (fd < 0) continue;
+
+    struct stat st;
+    char *mem = (char *)MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size > sizeof(msgq_header_t)) {
+      mem = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) continue;
+
+    // Readers of latest value queues only want the last message, they don't hold up the clock
+    msgq_header_t *header = (msgq_header_t *)mem;
+    if (header->version != MSGQ_VERSION || !(header->flags & MSGQ_FLAGS_VALID) || (header->flags & MSGQ_FLAGS_LATEST_VALUE) ||
+        MSGQ_HEADER_SIZE(header->max_readers) >= (size_t)st.st_size) {
+      munmap(mem, st.st_size);
+      continue;
+    }
+    queues.push_back({name, mem, (size_t)st.st_size, header, (msgq_reader_t *)(mem + sizeof(msgq_header_t))});
+  }
+  closedir(dir);
+  return queues;
+}
+
+static void close_queues(std::vector<Queue> &queues) {
+  for (auto &q : queues) munmap(q.mem, q.mem_size);
+  queues.clear();
+}
+
+// Returns the first queue with a live subscriber that has unread messages
+static const Queue *find_unread(const std::vector<Queue> &queues) {
+  for (const Queue &q : queues) {
+    uint64_t write_pointer = __atomic_load_n(&q.header->write_pointer, __ATOMIC_ACQUIRE);
+    uint64_t num_readers = std::min(q.header->num_readers, q.header->max_readers);
+    for (uint64_t i = 0; i < num_readers; i++) {
+      const msgq_reader_t &r = q.readers[i];
+      uint64_t uid = __atomic_load_n(&r.read_uid, __ATOMIC_ACQUIRE);
+      if (uid == 0 || !r.read_valid) continue;
+      if (__atomic_load_n(&r.read_pointer, __ATOMIC_ACQUIRE) == write_pointer) continue;
+      if (kill((pid_t)(uid & 0xFFFFFFFF), 0) != 0 && errno == ESRCH) continue;
+      return &q;
+    }
+  }
+  return nullptr;
+}
+
+static int num_participants(sim_clock_t *c) {
+  int n = 0;
+  for (auto &p : c->participants) n += (p.uid != 0);
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  int min_participants = 1;
+  double max_step_ms = 10, timeout_ms = 1000, duration = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:t:d:h")) != -1) {
+    switch (opt) {
+      case 'n': min_participants = atoi(optarg); break;
+      case 's': max_step_ms = atof(optarg); break;
+      case 't': timeout_ms = atof(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      default:
+        printf("usage: %s [-n participants] [-s max step in ms] [-t timeout in ms] [-d duration in seconds]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  signal(SIGINT, sig_handler);
+  signal(SIGTERM, sig_handler);
+
+  sim_clock_t *c = sim_clock_open(SIM_CLOCK_PATH);
+  if (c == nullptr) {
+    perror(SIM_CLOCK_PATH);
+    return 1;
+  }
+
+  printf("waiting for %d participants\n", min_participants);
+  while (!do_exit && num_participants(c) < min_participants) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  using clock = std::chrono::steady_clock;
+  const uint64_t max_step = max_step_ms * 1e6;
+  const uint64_t start_nanos = c->nanos;
+  auto start = clock::now(), last_step = start, last_print = start, last_scan = start;
+
+  std::vector<Queue> queues = open_queues();
+  uint64_t steps = 0, forced = 0, print_nanos = start_nanos;
+  while (!do_exit && (duration <= 0 || c->nanos - start_nanos < duration * 1e9)) {
+    auto now = clock::now();
+
+    // Pick up the queues of processes that started since
+    if (now - last_scan > std::chrono::seconds(1)) {
+      close_queues(queues);
+      queues = open_queues();
+      last_scan = now;
+    }
+
+    // The epoch didn't change if no participant ran while the queues were checked
+    uint64_t epoch = c->epoch, next_deadline;
+    const Queue *unread = nullptr;
+    bool idle = sim_clock_all_idle(c, &next_deadline) && (unread = find_unread(queues)) == nullptr &&
+                sim_clock_all_idle(c, &next_deadline) && c->epoch == epoch;
+
+    if (!idle && now - last_step > std::chrono::duration<double, std::milli>(timeout_ms)) {
+      fprintf(stderr, "stepping after timeout, %s\n",
+              unread ? ("unread messages on " + unread->name).c_str() : "a participant keeps running");
+      forced++;
+      idle = true;
+    }
+
+    if (idle) {
+      sim_clock_step(c, next_deadline, max_step);
+      steps++;
+      last_step = now;
+    } else {
+      std::this_thread::yield();
+    }
+
+    if (now - last_print > std::chrono::seconds(1)) {
+      double wall = std::chrono::duration<double>(now - last_print).count();
+      printf("sim time %.1f s, %.1fx realtime, %lu steps, %lu forced, %d participants\n", (c->nanos - start_nanos) * 1e-9,
+             (c->nanos - print_nanos) * 1e-9 / wall, (unsigned long)steps, (unsigned long)forced, num_participants(c));
+      last_print = now;
+      print_nanos = c->nanos;
+    }
+  }
+
+  close_queues(queues);
+  return 0;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+// Simulated clock to run the stack in lock-step, as fast as the CPUs allow.
+//
+// With SIM_CLOCK=1 nanos_since_boot() reads a clock that all processes share in /dev/shm/sim_clock,
+// and sleeps and msgq poll timeouts wait for that clock instead of the real one. Every thread that
+// waits on the clock is a participant: it is running until it waits and idle while it waits.
+// A driver (cereal/messaging/sim_clock) advances the clock to the earliest deadline a participant
+// waits for once all participants are idle and every subscriber read its messages. Publishing on
+// msgq wakes the idle participants too, so a poller gets the message without waiting for a step.
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#ifdef __APPLE__
+#include <pthread.h>
+#define CLOCK_BOOTTIME CLOCK_MONOTONIC
+#endif
+
+#define SIM_CLOCK_PATH "/dev/shm/sim_clock"
+#define SIM_CLOCK_VERSION 1
+#define SIM_CLOCK_MAX_PARTICIPANTS 256
+
+struct sim_clock_participant_t {
+  std::atomic<uint64_t> uid;  // pid << 32 | tid, 0 if the slot is free
+  std::atomic<uint64_t> running;
+  std::atomic<uint64_t> deadline;  // only valid while idle
+};
+
+struct sim_clock_t {
+  uint64_t version;
+  std::atomic<uint64_t> nanos;
+  // Bumped every time a participant starts running, so the driver can
+  // tell that nothing ran while it checked whether everything is idle
+  std::atomic<uint64_t> epoch;
+  // Bumped on every step, idle participants wait on it with a futex
+  std::atomic<uint32_t> seq;
+  sim_clock_participant_t participants[SIM_CLOCK_MAX_PARTICIPANTS];
+};
+
+// Maps the clock at path, a new clock starts at the current boot time
+inline sim_clock_t *sim_clock_open(const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT, 0777);
+  if (fd < 0) return nullptr;
+
+  if (ftruncate(fd, sizeof(sim_clock_t)) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  void *mem = mmap(NULL, sizeof(sim_clock_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return nullptr;
+
+  sim_clock_t *c = (sim_clock_t *)mem;
+  if (c->version != SIM_CLOCK_VERSION) {
+    struct timespec t;
+    clock_gettime(CLOCK_BOOTTIME, &t);
+    c->nanos = t.tv_sec * 1000000000ULL + t.tv_nsec;
+    c->version = SIM_CLOCK_VERSION;
+  }
+  return c;
+}
+
+// The shared clock if SIM_CLOCK=1, nullptr otherwise
+inline sim_clock_t *sim_clock() {
+  static sim_clock_t *c = [] {
+    const char *env = getenv("SIM_CLOCK");
+    return (env != nullptr && strcmp(env, "1") == 0) ? sim_clock_open(SIM_CLOCK_PATH) : nullptr;
+  }();
+  return c;
+}
+
+inline uint64_t sim_clock_nanos(sim_clock_t *c) {
+  return c->nanos;
+}
+
+inline void sim_clock_futex_wait(std::atomic<uint32_t> *addr, uint32_t val, int ms) {
+  struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+#ifdef __linux__
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+#else
+  if (*addr == val) nanosleep(&ts, NULL);
+#endif
+}
+
+inline void sim_clock_futex_wake(std::atomic<uint32_t> *addr) {
+#ifdef __linux__
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif
+}
+
+// A thread takes a participant slot on its first wait and frees it when it exits
+class SimClockParticipant {
+public:
+  SimClockParticipant(sim_clock_t *c) {
+#ifdef __APPLE__
+    uint64_t tid = (uint64_t)pthread_mach_thread_np(pthread_self());
+#else
+    uint64_t tid = syscall(SYS_gettid);
+#endif
+    uint64_t uid = ((uint64_t)getpid() << 32) | (tid & 0xFFFFFFFF);
+    for (auto &p : c->participants) {
+      uint64_t free_uid = 0;
+      if (p.uid.compare_exchange_strong(free_uid, uid)) {
+        p.running = 1;
+        slot = &p;
+        break;
+      }
+    }
+  }
+  ~SimClockParticipant() {
+    if (slot) {
+      slot->running = 0;
+      slot->uid = 0;
+    }
+  }
+  sim_clock_participant_t *slot = nullptr;
+};
+
+// Waits until the clock reaches deadline, or until wake() returns true. wake is called while the
+// thread is idle, every time the clock steps or sim_clock_wake() is called. It shouldn't block.
+template <typename F>
+inline void sim_clock_wait_until(sim_clock_t *c, uint64_t deadline, F wake) {
+  static thread_local SimClockParticipant participant(c);
+  sim_clock_participant_t *p = participant.slot;
+
+  // The deadline has to be visible before the driver sees the thread idle
+  if (p) {
+    p->deadline = deadline;
+    p->running = 0;
+  }
+
+  while (true) {
+    uint32_t cur_seq = c->seq;
+    if (c->nanos >= deadline || wake()) break;
+    sim_clock_futex_wait(&c->seq, cur_seq, 100);
+  }
+
+  if (p) p->running = 1;
+  c->epoch++;
+}
+
+inline void sim_clock_wait_until(sim_clock_t *c, uint64_t deadline) {
+  sim_clock_wait_until(c, deadline, [] { return false; });
+}
+
+// Returns false if a participant is running, otherwise the earliest deadline of the idle ones.
+// Slots of participants whose process died are freed.
+inline bool sim_clock_all_idle(sim_clock_t *c, uint64_t *next_deadline) {
+  *next_deadline = UINT64_MAX;
+  for (auto &p : c->participants) {
+    uint64_t uid = p.uid;
+    if (uid == 0) continue;
+
+    if (kill((pid_t)(uid >> 32), 0) != 0 && errno == ESRCH) {
+      p.running = 0;
+      p.uid.compare_exchange_strong(uid, 0);
+      continue;
+    }
+    // A participant whose deadline passed is about to run
+    if (p.running || p.deadline <= c->nanos) return false;
+    if (p.deadline < *next_deadline) *next_deadline = p.deadline;
+  }
+  return true;
+}
+
+// Makes the idle participants check for their events again
+inline void sim_clock_wake(sim_clock_t *c) {
+  c->seq++;
+  sim_clock_futex_wake(&c->seq);
+}
+
+// Advances the clock to next, but at least by 1 ns and at most by max_step, and wakes the participants
+inline uint64_t sim_clock_step(sim_clock_t *c, uint64_t next, uint64_t max_step) {
+  uint64_t now = c->nanos;
+  next = (next <= now) ? now + 1 : (next - now > max_step ? now + max_step : next);
+
+  c->nanos = next;
+  sim_clock_wake(c);
+  return next;
+}
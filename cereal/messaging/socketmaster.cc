@@ -10,18 +10,13 @@
 const bool SIMULATION = (getenv("SIMULATION") != nullptr) && (std::string(getenv("SIMULATION")) == "1");
 
 static inline uint64_t nanos_since_boot() {
+  if (sim_clock_t *c = sim_clock()) return c->nanos;
+
   struct timespec t;
   clock_gettime(CLOCK_BOOTTIME, &t);
   return t.tv_sec * 1000000000ULL + t.tv_nsec;
 }
 
-static const service *get_service(const char *name) {
-  for (const auto &it : services) {
-    if (strcmp(it.name, name) == 0) return &it;
-  }
-  return nullptr;
-}
-
 static inline bool inList(const std::vector<const char *> &list, const char *value) {
   for (auto &v : list) {
     if (strcmp(value, v) == 0) return true;
@@ -52,16 +47,29 @@ struct SubMaster::SubMessage {
   uint64_t rcv_time = 0, rcv_frame = 0;
   void *allocated_msg_reader = nullptr;
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
-  AlignedBuffer aligned_buf;
+  // The event points into one buffer while the next message is copied into the other,
+  // so a message that turns out to be overwritten doesn't clobber the last good one
+  AlignedBuffer aligned_buf[2];
+  int buf_idx = 0;
   cereal::Event::Reader event;
+
+  void set(uint64_t current_time, uint64_t current_frame, cereal::Event::Reader e) {
+    event = e;
+    updated = true;
+    rcv_time = current_time;
+    rcv_frame = current_frame;
+    valid = event.getValid();
+    if (SIMULATION) alive = true;
+  }
 };
 
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const char *address,
                      const std::vector<const char *> &ignore_alive) {
   poller_ = Poller::create();
   for (auto name : service_list) {
-    const service *serv = get_service(name);
-    assert(serv != nullptr);
+    int idx = get_service_index(name);
+    assert(idx >= 0);
+    const service *serv = &services[idx];
     SubSocket *socket = SubSocket::create(message_context.context(), name, address ? address : "127.0.0.1", true);
     assert(socket != 0);
     poller_->registerSocket(socket);
@@ -72,54 +80,62 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const char *
       .ignore_alive = inList(ignore_alive, name),
       .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader))};
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
-    messages_[socket] = m;
-    services_[name] = m;
+    messages_.push_back(m);
+    services_[idx] = m;
   }
+  ready_.reserve(messages_.size());
 }
 
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  for (auto m : messages_) m->updated = false;
 
-  auto sockets = poller_->poll(timeout);
+  // Steady state updates don't allocate, the ready list and message buffers are reused
+  poller_->poll_indices(timeout, ready_);
   uint64_t current_time = nanos_since_boot();
+  if (++frame == UINT64_MAX) frame = 1;
 
-  std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
-
-  for (auto s : sockets) {
-    Message *msg = s->receive(true);
-    if (msg == nullptr) continue;
-
-    SubMessage *m = messages_.at(s);
+  for (size_t i : ready_) {
+    SubMessage *m = messages_[i];
+    SubSocket *s = m->socket;
+    AlignedBuffer &buf = m->aligned_buf[m->buf_idx ^ 1];
+
+    char *data;
+    size_t size;
+    bool valid = false;
+    while (!valid && s->receive_borrowed(&data, &size)) {
+      kj::ArrayPtr<const capnp::word> words = buf.align(data, size);
+      valid = s->release_borrowed();
+      if (valid) {
+        m->msg_reader->~FlatArrayMessageReader();
+        m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(words);
+        m->buf_idx ^= 1;
+      }
+    }
+    if (!valid) continue;
 
-    m->msg_reader->~FlatArrayMessageReader();
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg));
-    delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+    m->set(current_time, frame, m->msg_reader->getRoot<cereal::Event>());
   }
 
-  update_msgs(current_time, messages);
+  update_alive(current_time);
 }
 
 void SubMaster::update_msgs(uint64_t current_time, std::vector<std::pair<std::string, cereal::Event::Reader>> messages){
   if (++frame == UINT64_MAX) frame = 1;
 
   for(auto &kv : messages) {
-    auto m_find = services_.find(kv.first);
-    if (m_find == services_.end()){
+    int idx = get_service_index(kv.first.c_str());
+    if (idx < 0 || services_[idx] == nullptr){
       continue;
     }
-    SubMessage *m = m_find->second;
-    m->event = kv.second;
-    m->updated = true;
-    m->rcv_time = current_time;
-    m->rcv_frame = frame;
-    m->valid = m->event.getValid();
-    if (SIMULATION) m->alive = true;
+    services_[idx]->set(current_time, frame, kv.second);
   }
 
+  update_alive(current_time);
+}
+
+void SubMaster::update_alive(uint64_t current_time) {
   if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
+    for (auto m : messages_) {
       m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
     }
   }
@@ -127,8 +143,7 @@ void SubMaster::update_msgs(uint64_t current_time, std::vector<std::pair<std::st
 
 bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) {
   int found = 0;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     if (service_list.size() == 0 || inList(service_list, m->name.c_str())) {
       found += (!valid || m->valid) && (!alive || (m->alive || m->ignore_alive));
     }
@@ -138,45 +153,54 @@ bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid,
 
 void SubMaster::drain() {
   while (true) {
-    auto polls = poller_->poll(0);
-    if (polls.size() == 0)
+    poller_->poll_indices(0, ready_);
+    if (ready_.size() == 0)
       break;
 
-    for (auto sock : polls) {
-      Message *msg = sock->receive(true);
-      delete msg;
+    for (size_t i : ready_) {
+      SubSocket *sock = messages_[i]->socket;
+      char *data;
+      size_t size;
+      while (sock->receive_borrowed(&data, &size)) {
+        sock->release_borrowed();
+      }
     }
   }
 }
 
-bool SubMaster::updated(const char *name) const {
-  return services_.at(name)->updated;
+SubMaster::SubMessage *SubMaster::get(ServiceId id) const {
+  SubMessage *m = services_[(int)id];
+  if (m == nullptr) throw std::out_of_range(services[(int)id].name);
+  return m;
+}
+
+bool SubMaster::updated(ServiceId id) const {
+  return get(id)->updated;
 }
 
-bool SubMaster::alive(const char *name) const {
-  return services_.at(name)->alive;
+bool SubMaster::alive(ServiceId id) const {
+  return get(id)->alive;
 }
 
-bool SubMaster::valid(const char *name) const {
-  return services_.at(name)->valid;
+bool SubMaster::valid(ServiceId id) const {
+  return get(id)->valid;
 }
 
-uint64_t SubMaster::rcv_frame(const char *name) const {
-  return services_.at(name)->rcv_frame;
+uint64_t SubMaster::rcv_frame(ServiceId id) const {
+  return get(id)->rcv_frame;
 }
 
-uint64_t SubMaster::rcv_time(const char *name) const {
-  return services_.at(name)->rcv_time;
+uint64_t SubMaster::rcv_time(ServiceId id) const {
+  return get(id)->rcv_time;
 }
 
-cereal::Event::Reader &SubMaster::operator[](const char *name) const {
-  return services_.at(name)->event;
+cereal::Event::Reader &SubMaster::operator[](ServiceId id) const {
+  return get(id)->event;
 };
 
 SubMaster::~SubMaster() {
   delete poller_;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     m->msg_reader->~FlatArrayMessageReader();
     free(m->allocated_msg_reader);
     delete m->socket;
@@ -186,18 +210,34 @@ SubMaster::~SubMaster() {
 
 PubMaster::PubMaster(const std::vector<const char *> &service_list) {
   for (auto name : service_list) {
-    assert(get_service(name) != nullptr);
+    int idx = get_service_index(name);
+    assert(idx >= 0);
     PubSocket *socket = PubSocket::create(message_context.context(), name);
     assert(socket);
-    sockets_[name] = socket;
+    sockets_[idx] = socket;
   }
 }
 
-int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+PubSocket *PubMaster::get(ServiceId id) const {
+  PubSocket *socket = sockets_[(int)id];
+  if (socket == nullptr) throw std::out_of_range(services[(int)id].name);
+  return socket;
+}
+
+int PubMaster::send(ServiceId id, MessageBuilder &msg) {
+  // Serialize straight into the queue instead of going through a flat array copy
+  auto segments = msg.getSegmentsForOutput();
+  size_t size = capnp::computeSerializedSizeInWords(segments) * sizeof(capnp::word);
+
+  PubSocket *socket = get(id);
+  char *buf = socket->reserve(size);
+  if (buf == nullptr) return -1;
+
+  kj::ArrayOutputStream stream(kj::arrayPtr((kj::byte *)buf, size));
+  capnp::writeMessage(stream, segments);
+  return socket->commit();
 }
 
 PubMaster::~PubMaster() {
-  for (auto s : sockets_) delete s.second;
+  for (auto s : sockets_) delete s;
 }
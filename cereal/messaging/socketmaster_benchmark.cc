@@ -0,0 +1,90 @@
+// SubMaster::update overhead and heap allocations for a growing number of services. Results are printed as JSON.
+// Build with scons --bench and run cereal/messaging/socketmaster_benchmark > socketmaster.json
+// Don't run this while openpilot is running, it publishes on the real services.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "services.h"
+#include "messaging.h"
+#include "alloc_counter.h"
+
+static uint64_t nanos_since_epoch() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double percentile(std::vector<uint64_t> &v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(v.size() * p))];
+}
+
+static std::vector<const char *> get_services(size_t num_services) {
+  // Leave out the services with large queues, like the camera states
+  std::vector<const char *> names;
+  for (const auto &it : services) {
+    if (names.size() == num_services) break;
+    if (it.buffer_size <= 10 * 1024 * 1024) names.push_back(it.name);
+  }
+  return names;
+}
+
+// Time spent in update when every service has a new message, and when none of them do
+static std::string bench_update(size_t num_services, int iterations) {
+  const int warmup = 10;
+  std::vector<const char *> names = get_services(num_services);
+  PubMaster pm(names);
+  SubMaster sm(names);
+  ReusableMessageBuilder builder;
+
+  std::vector<uint64_t> updated, idle;
+  updated.reserve(iterations);
+  idle.reserve(iterations);
+  uint64_t send_allocs = 0, update_allocs = 0;
+  for (int i = 0; i < warmup + iterations; i++) {
+    uint64_t allocs_before = num_allocs;
+    for (auto name : names) {
+      MessageBuilder &msg = builder.reset();
+      msg.initEvent();
+      pm.send(name, msg);
+    }
+    uint64_t allocs_after_send = num_allocs;
+
+    uint64_t start = nanos_since_epoch();
+    sm.update(0);
+    uint64_t updated_time = nanos_since_epoch() - start;
+
+    start = nanos_since_epoch();
+    sm.update(0);
+    uint64_t idle_time = nanos_since_epoch() - start;
+
+    if (i >= warmup) {
+      send_allocs += allocs_after_send - allocs_before;
+      update_allocs += num_allocs - allocs_after_send;
+      updated.push_back(updated_time);
+      idle.push_back(idle_time);
+    }
+  }
+
+  char out[512];
+  snprintf(out, sizeof(out), "{\"services\": %zu, \"update_p50_us\": %.2f, \"update_p99_us\": %.2f, \"idle_update_p50_us\": %.2f, \"idle_update_p99_us\": %.2f, \"allocs_per_update\": %.2f, \"allocs_per_send\": %.2f}",
+           names.size(), percentile(updated, 0.5) / 1e3, percentile(updated, 0.99) / 1e3,
+           percentile(idle, 0.5) / 1e3, percentile(idle, 0.99) / 1e3,
+           (double)update_allocs / (2 * iterations), (double)send_allocs / (names.size() * iterations));
+  return out;
+}
+
+int main(int argc, char** argv) {
+  std::string results;
+  for (size_t num_services : {5, 10, 20, 40}) {
+    results += (results.empty() ? "" : ",\n    ") + bench_update(num_services, 1000);
+  }
+
+  printf("{\n");
+  printf("  \"submaster_update\": [\n    %s\n  ]\n", results.c_str());
+  printf("}\n");
+  return 0;
+}
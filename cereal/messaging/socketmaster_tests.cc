@@ -0,0 +1,41 @@
+// Built as a binary of its own, the allocation counter replaces the allocator of the whole program
+#define CATCH_CONFIG_MAIN
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "messaging.h"
+#include "alloc_counter.h"
+
+TEST_CASE("SubMaster and PubMaster don't allocate in steady state"){
+  // A ring buffer and a latest value queue, see services.py
+  std::vector<const char *> names = {"testSocketmaster", "testSocketmasterLatest"};
+  PubMaster pm(names);
+  SubMaster sm(names);
+  ReusableMessageBuilder builder;
+
+  size_t num_updated = 0;
+  auto publish_and_update = [&]() {
+    for (auto name : names) {
+      MessageBuilder &msg = builder.reset();
+      msg.initEvent();
+      pm.send(name, msg);
+    }
+    sm.update(0);
+    for (auto name : names) num_updated += sm.updated(name);
+
+    // Nothing new
+    sm.update(0);
+  };
+
+  // The first messages size the receive buffers
+  for (int i = 0; i < 10; i++) publish_and_update();
+
+  const int iterations = 100;
+  num_updated = 0;
+  uint64_t allocs_before = num_allocs;
+  for (int i = 0; i < iterations; i++) publish_and_update();
+  uint64_t allocs = num_allocs - allocs_before;
+
+  REQUIRE(num_updated == iterations * names.size());
+  REQUIRE(allocs == 0);
+}
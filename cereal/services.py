@@ -12,12 +12,40 @@ def new_port(port: int):
   return port + 1 if port >= RESERVED_PORT else port
 
 
+# msgq buffers hold BUFFER_RETENTION seconds of messages of the expected size, with room
+# for at least MIN_BUFFER_MSGS of them. A publisher asserts that three messages fit in the
+# buffer, so it also holds three messages of the largest size the service can send.
+# Check the sizes against a real drive with selfdrive/debug/msgq_usage.py
+BUFFER_RETENTION = 10.  # seconds
+MIN_BUFFER_MSGS = 16
+DEFAULT_MSG_SIZE = 1024
+DEFAULT_MAX_MSG_SIZE = 64 * 1024
+DEFAULT_NUM_READERS = 16
+
+
+def get_buffer_size(frequency: float, msg_size: int, max_msg_size: int = DEFAULT_MAX_MSG_SIZE) -> int:
+  entry_size = msg_size + 8  # size tag
+  max_entry_size = (max_msg_size + 8 + 7) // 8 * 8  # size tag, 8 byte aligned
+  size = max(frequency * entry_size * BUFFER_RETENTION, MIN_BUFFER_MSGS * entry_size, 3 * max_entry_size)
+  return (int(size) + 4095) // 4096 * 4096
+
+
 class Service:
-  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None):
+  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None,
+               msg_size: int = DEFAULT_MSG_SIZE, max_msg_size: int = DEFAULT_MAX_MSG_SIZE, buffer_size: Optional[int] = None,
+               num_readers: int = DEFAULT_NUM_READERS, multiple_publishers: bool = False, latest_value: bool = False):
+    assert not (multiple_publishers and latest_value), "latest value queues have a single publisher"
     self.port = port
     self.should_log = should_log
     self.frequency = frequency
     self.decimation = decimation
+    self.msg_size = msg_size
+    self.max_msg_size = max_msg_size
+    self.buffer_size = get_buffer_size(frequency, msg_size, max_msg_size) if buffer_size is None else buffer_size
+    assert self.buffer_size >= get_buffer_size(0., 0, max_msg_size), "the buffer has to fit three messages of max_msg_size"
+    self.num_readers = num_readers
+    self.multiple_publishers = multiple_publishers
+    self.latest_value = latest_value
 
 DCAM_FREQ = 10. if not TICI else 20.
 
@@ -61,8 +89,51 @@ services = {
   "modelV2": (True, 20., 40),
   "managerState": (True, 2., 1),
   "uploaderState": (True, 0., 1),
+  "latencyStats": (True, 1., 1),
+  "visionipcStats": (True, 1., 1),
+
+  # only for the messaging tests, so they don't publish on the services of a running openpilot
+  "testSocketmaster": (False, 0.),
+  "testSocketmasterLatest": (False, 0.),
 }
-service_list = {name: Service(new_port(idx), *vals) for  # type: ignore
+
+# msgq settings that differ from the defaults
+# service: {msg_size: expected message size in bytes, max_msg_size: largest message in bytes,
+#           buffer_size: override, num_readers: reader slots,
+#           multiple_publishers: allow several processes to publish at the same time,
+#           latest_value: only keep the newest message, for services where no reader wants older ones.
+#                         Readers don't take a reader slot, but messages that come in faster than
+#                         a reader polls are skipped, including by loggerd}
+queue_config = {
+  "sensorEvents": {"msg_size": 2048},
+  "can": {"msg_size": 8192},
+  "controlsState": {"msg_size": 2048, "num_readers": 32},
+  "sendcan": {"msg_size": 4096},
+  "liveTracks": {"msg_size": 8192},
+  "logMessage": {"msg_size": 4096, "max_msg_size": 1024 * 1024, "multiple_publishers": True},
+  "androidLog": {"msg_size": 4096, "max_msg_size": 1024 * 1024, "multiple_publishers": True},
+  "carState": {"num_readers": 32},
+  "longitudinalPlan": {"msg_size": 2048},
+  "procLog": {"msg_size": 64 * 1024, "max_msg_size": 1024 * 1024},
+  "ubloxGnss": {"msg_size": 4096},
+  "ubloxRaw": {"msg_size": 4096},
+  "liveLocationKalman": {"msg_size": 4096},
+  "lateralPlan": {"msg_size": 2048},
+  "thumbnail": {"msg_size": 256 * 1024, "max_msg_size": 1024 * 1024},
+  "carParams": {"msg_size": 8192},
+  "deviceState": {"latest_value": True},
+  "modelV2": {"msg_size": 32 * 1024, "max_msg_size": 256 * 1024, "num_readers": 32},
+  "liveCalibration": {"latest_value": True},
+  "latencyStats": {"msg_size": 4096, "multiple_publishers": True},
+  "visionipcStats": {"msg_size": 4096},
+  # leave room for the full frames camerad attaches for debugging (SEND_ROAD etc.)
+  "roadCameraState": {"max_msg_size": 8 * 1024 * 1024, "buffer_size": 100 * 1024 * 1024},
+  "driverCameraState": {"max_msg_size": 8 * 1024 * 1024, "buffer_size": 100 * 1024 * 1024},
+  "wideRoadCameraState": {"max_msg_size": 8 * 1024 * 1024, "buffer_size": 100 * 1024 * 1024},
+  "testSocketmasterLatest": {"latest_value": True},
+}
+
+service_list = {name: Service(new_port(idx), *vals, **queue_config.get(name, {})) for  # type: ignore
                 idx, (name, vals) in enumerate(services.items())}
 
 
@@ -71,13 +142,20 @@ def build_header():
   h += "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT services.py */\n"
   h += "#ifndef __SERVICES_H\n"
   h += "#define __SERVICES_H\n"
-  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; };\n"
-  h += "static struct service services[] = {\n"
+  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; int buffer_size; int num_readers; bool multiple_publishers; bool latest_value; };\n"
+  h += "enum class ServiceId {\n"
+  for k in service_list:
+    h += "  %s,\n" % k
+  h += "};\n"
+  h += "static constexpr int NUM_SERVICES = %d;\n" % len(service_list)
+  h += "static constexpr struct service services[] = {\n"
   for k, v in service_list.items():
     should_log = "true" if v.should_log else "false"
     decimation = -1 if v.decimation is None else v.decimation
-    h += '  { "%s", %d, %s, %d, %d },\n' % \
-         (k, v.port, should_log, v.frequency, decimation)
+    multiple_publishers = "true" if v.multiple_publishers else "false"
+    latest_value = "true" if v.latest_value else "false"
+    h += '  { "%s", %d, %s, %d, %d, %d, %d, %s, %s },\n' % \
+         (k, v.port, should_log, v.frequency, decimation, v.buffer_size, v.num_readers, multiple_publishers, latest_value)
   h += "};\n"
   h += "#endif\n"
   return h
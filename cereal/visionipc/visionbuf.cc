@@ -1,5 +1,16 @@
 #include "visionbuf.h"
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
 #define ALIGN(x, align) (((x) + (align)-1) & ~((align)-1))
 
 #ifdef QCOM
@@ -29,12 +40,100 @@ void VisionBuf::init_rgb(size_t width, size_t height, size_t stride) {
   this->stride = stride;
 }
 
-void VisionBuf::init_yuv(size_t width, size_t height){
+// I420 is packed, the OpenCL transforms of modeld expect it that way. NV12 goes to the hardware
+// encoder, on the devices it gets the layout of the encoder's input buffers so it is copied as is.
+void visionbuf_compute_yuv_layout(size_t width, size_t height, bool nv12, size_t *stride, size_t *uv_offset, size_t *size) {
+#if defined(QCOM) || defined(QCOM2)
+  if (nv12) {
+    // VENUS_Y_STRIDE, VENUS_Y_SCANLINES, VENUS_UV_SCANLINES and VENUS_BUFFER_SIZE for COLOR_FMT_NV12
+    *stride = ALIGN(width, 128);
+    *uv_offset = *stride * ALIGN(height, 32);
+    *size = ALIGN(*uv_offset + *stride * ALIGN(height / 2, 16) + 4096 + std::max<size_t>(16 * 1024, 8 * *stride), 4096);
+    return;
+  }
+#endif
+  *stride = width;
+  *uv_offset = width * height;
+  *size = width * height * 3 / 2;
+}
+
+void VisionBuf::init_yuv(size_t width, size_t height, size_t stride, size_t uv_offset, bool nv12){
   this->rgb = false;
+  this->nv12 = nv12;
   this->width = width;
   this->height = height;
+  this->stride = stride;
+  this->uv_offset = uv_offset;
 
   this->y = (uint8_t *)this->addr;
-  this->u = this->y + (width * height);
-  this->v = this->u + (width / 2 * height / 2);
+  if (nv12) {
+    this->uv_stride = stride;
+    this->uv = this->y + uv_offset;
+    this->u = this->v = nullptr;
+  } else {
+    this->uv_stride = stride / 2;
+    this->u = this->y + uv_offset;
+    this->v = this->u + (this->uv_stride * (height / 2));
+    this->uv = nullptr;
+  }
+}
+
+// Averages 2x2 blocks of src, width and height are the ones of dst
+void visionbuf_halve_plane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, size_t width, size_t height) {
+  for (size_t y = 0; y < height; y++) {
+    const uint8_t *r0 = src + 2 * y * src_stride;
+    const uint8_t *r1 = r0 + src_stride;
+    uint8_t *d = dst + y * dst_stride;
+
+    size_t x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 8 <= width; x += 8) {
+      uint16x8_t sum = vpaddlq_u8(vld1q_u8(r0 + 2 * x));
+      sum = vpadalq_u8(sum, vld1q_u8(r1 + 2 * x));
+      vst1_u8(d + x, vrshrn_n_u16(sum, 2));
+    }
+#elif defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(0xFF), two = _mm_set1_epi16(2);
+    for (; x + 8 <= width; x += 8) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(r0 + 2 * x));
+      __m128i b = _mm_loadu_si128((const __m128i *)(r1 + 2 * x));
+      __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)),
+                                  _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)));
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      _mm_storel_epi64((__m128i *)(d + x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; x < width; x++) {
+      d[x] = (r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2;
+    }
+  }
+}
+
+// Copies a width x height rectangle of src, flipped left to right if mirror is set
+void visionbuf_crop_plane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, size_t width, size_t height, bool mirror) {
+  for (size_t y = 0; y < height; y++) {
+    const uint8_t *s = src + y * src_stride;
+    uint8_t *d = dst + y * dst_stride;
+    if (!mirror) {
+      memcpy(d, s, width);
+      continue;
+    }
+
+    size_t x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+      uint8x16_t v = vrev64q_u8(vld1q_u8(s + width - x - 16));
+      vst1q_u8(d + x, vcombine_u8(vget_high_u8(v), vget_low_u8(v)));
+    }
+#elif defined(__SSSE3__)
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    for (; x + 16 <= width; x += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + width - x - 16));
+      _mm_storeu_si128((__m128i *)(d + x), _mm_shuffle_epi8(v, reverse));
+    }
+#endif
+    for (; x < width; x++) {
+      d[x] = s[width - 1 - x];
+    }
+  }
 }
@@ -18,6 +18,12 @@ enum VisionStreamType {
   VISION_STREAM_YUV_BACK,
   VISION_STREAM_YUV_FRONT,
   VISION_STREAM_YUV_WIDE,
+  VISION_STREAM_YUV_BACK_HALF,
+  VISION_STREAM_YUV_BACK_QUARTER,
+  VISION_STREAM_YUV_FRONT_CROP,
+  VISION_STREAM_NV12_BACK,
+  VISION_STREAM_NV12_FRONT,
+  VISION_STREAM_NV12_WIDE,
   VISION_STREAM_MAX,
 };
 
@@ -33,10 +39,15 @@ class VisionBuf {
   size_t height = 0;
   size_t stride = 0;
 
-  // YUV
+  // YUV, the y plane is at addr with the stride above. I420 has a u and a v plane of uv_stride,
+  // the v plane right after the u plane. NV12 has one plane with interleaved u and v instead.
+  bool nv12 = false;
+  size_t uv_offset = 0;
+  size_t uv_stride = 0;
   uint8_t * y = nullptr;
-  uint8_t * u = nullptr;
-  uint8_t * v = nullptr;
+  uint8_t * u = nullptr;  // I420 only
+  uint8_t * v = nullptr;  // I420 only
+  uint8_t * uv = nullptr;  // NV12 only
 
   // Visionipc
   uint64_t server_id = 0;
@@ -55,9 +66,12 @@ class VisionBuf {
   void import();
   void init_cl(cl_device_id device_id, cl_context ctx);
   void init_rgb(size_t width, size_t height, size_t stride);
-  void init_yuv(size_t width, size_t height);
+  void init_yuv(size_t width, size_t height, size_t stride, size_t uv_offset, bool nv12=false);
   void sync(int dir);
   void free();
 };
 
 void visionbuf_compute_aligned_width_and_height(int width, int height, int *aligned_w, int *aligned_h);
+void visionbuf_compute_yuv_layout(size_t width, size_t height, bool nv12, size_t *stride, size_t *uv_offset, size_t *size);
+void visionbuf_halve_plane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, size_t width, size_t height);
+void visionbuf_crop_plane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, size_t width, size_t height, bool mirror);
@@ -5,13 +5,58 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 std::atomic<int> offset = 0;
 
-static void *malloc_with_fd(size_t len, int *fd) {
+// Buffers of at least this size go in huge pages, smaller ones would waste most of a page
+#define HUGEPAGE_MIN_LEN (1 << 20)
+
+static void *mmap_fd(int fd, size_t len) {
+  if (ftruncate(fd, len) != 0) return MAP_FAILED;
+  return mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+}
+
+#if defined(__linux__) && defined(MFD_HUGETLB)
+// An anonymous memfd, in huge pages if there are free ones. The size is sealed so clients can't
+// shrink the buffer under the server. VISIONBUF_HUGEPAGES=0 turns off huge pages.
+static void *memfd_alloc(size_t len, int *fd, size_t *mmap_len) {
+  const char *env = getenv("VISIONBUF_HUGEPAGES");
+  if (len >= HUGEPAGE_MIN_LEN && !(env && strcmp(env, "0") == 0)) {
+    *fd = memfd_create("visionbuf", MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB);
+    struct stat st;
+    if (*fd >= 0 && fstat(*fd, &st) == 0) {
+      // st_blksize is the huge page size, the mapping is a multiple of it
+      *mmap_len = (len + st.st_blksize - 1) / st.st_blksize * st.st_blksize;
+      void *addr = mmap_fd(*fd, *mmap_len);
+      if (addr != MAP_FAILED) return addr;
+    }
+    if (*fd >= 0) close(*fd);
+  }
+
+  *fd = memfd_create("visionbuf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (*fd < 0) return MAP_FAILED;
+  *mmap_len = len;
+  void *addr = mmap_fd(*fd, *mmap_len);
+  if (addr == MAP_FAILED) close(*fd);
+  return addr;
+}
+#endif
+
+static void *malloc_with_fd(size_t len, int *fd, size_t *mmap_len) {
+#if defined(__linux__) && defined(MFD_HUGETLB)
+  void *memfd_addr = memfd_alloc(len, fd, mmap_len);
+  if (memfd_addr != MAP_FAILED) {
+    fcntl(*fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    return memfd_addr;
+  }
+#endif
+
+  // Kernels without memfd and macOS use a file that is unlinked right away
   char full_path[0x100];
 
 #ifdef __APPLE__
@@ -25,8 +70,8 @@ static void *malloc_with_fd(size_t len, int *fd) {
 
   unlink(full_path);
 
-  ftruncate(*fd, len);
-  void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  *mmap_len = len;
+  void *addr = mmap_fd(*fd, len);
   assert(addr != MAP_FAILED);
 
   return addr;
@@ -34,10 +79,11 @@ static void *malloc_with_fd(size_t len, int *fd) {
 
 void VisionBuf::allocate(size_t len) {
   int fd;
-  void *addr = malloc_with_fd(len, &fd);
+  size_t mmap_len;
+  void *addr = malloc_with_fd(len, &fd, &mmap_len);
 
   this->len = len;
-  this->mmap_len = len;
+  this->mmap_len = mmap_len;
   this->addr = addr;
   this->fd = fd;
 }
@@ -81,6 +127,6 @@ void VisionBuf::free() {
     clReleaseCommandQueue(this->copy_q);
   }
 
-  munmap(this->addr, this->len);
+  munmap(this->addr, this->mmap_len);
   close(this->fd);
 }
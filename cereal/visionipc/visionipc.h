@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
 
 constexpr int VISIONIPC_MAX_FDS = 128;
+constexpr int VISIONIPC_MAX_CLIENTS = 16;
 
 struct VisionIpcBufExtra {
   uint32_t frame_id;
@@ -15,4 +17,25 @@ struct VisionIpcPacket {
   uint64_t server_id;
   size_t idx;
   struct VisionIpcBufExtra extra;
+  uint64_t seq;
+};
+
+// Lease table of one stream, shared by the server with its clients. Every packet gets a sequence
+// number, and a client holds the buffers of all packets after the last one it released. The server
+// doesn't hand out a buffer that a client holds, unless all of them are held.
+struct VisionIpcLease {
+  std::atomic<uint64_t> uid;  // pid << 32 | client number, 0 if the slot is free
+  char name[16];
+  std::atomic<uint64_t> released;  // seq of the last packet the client is done with
+  std::atomic<uint64_t> connect_seq;
+
+  // Written by the server
+  std::atomic<uint64_t> drops;  // buffers overwritten while the client held them
+  std::atomic<uint32_t> max_held;
+};
+
+struct VisionIpcLeaseTable {
+  std::atomic<uint64_t> seq;  // of the last packet sent
+  std::atomic<uint64_t> buf_seq[VISIONIPC_MAX_FDS];  // of the last packet sent in each buffer
+  VisionIpcLease clients[VISIONIPC_MAX_CLIENTS];
 };
@@ -0,0 +1,157 @@
+// VisionIPC throughput with and without huge page backed buffers. Results are printed as JSON so they
+// can be compared between builds. Build with scons --bench and run cereal/visionipc/visionipc_benchmark
+// Huge pages have to be reserved first, e.g. echo 256 > /proc/sys/vm/nr_hugepages
+// Don't run this while camerad is running, it serves the same socket.
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "visionipc_client.h"
+#include "visionipc_server.h"
+
+static uint64_t nanos_since_epoch() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void pin_to_core(int core) {
+#ifdef __linux__
+  int num_cores = std::thread::hardware_concurrency();
+  if (num_cores <= 1) return;
+
+  cpu_set_t cpu;
+  CPU_ZERO(&cpu);
+  CPU_SET(core % num_cores, &cpu);
+  sched_setaffinity(0, sizeof(cpu), &cpu);
+#endif
+}
+
+static double percentile(std::vector<uint64_t> &v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(v.size() * p))];
+}
+
+static std::string join(const std::vector<std::string> &items) {
+  std::string s;
+  for (size_t i = 0; i < items.size(); i++) {
+    s += (i > 0 ? ",\n    " : "") + items[i];
+  }
+  return "[\n    " + s + "\n  ]";
+}
+
+// Huge page backed files report the huge page size as block size
+static bool is_hugepage_backed(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && st.st_blksize > 4096;
+}
+
+// The server writes every byte of a frame and the client reads every byte, like camerad and its
+// consumers do. The server stays at most half the buffers ahead of the client, so nothing is dropped.
+static std::string bench_throughput(bool hugepages, bool rgb, size_t width, size_t height, size_t num_buffers, int num_frames) {
+  setenv("VISIONBUF_HUGEPAGES", hugepages ? "1" : "0", 1);
+  const VisionStreamType type = rgb ? VISION_STREAM_RGB_BACK : VISION_STREAM_YUV_BACK;
+
+  VisionIpcServer server("camerad");
+  uint64_t start = nanos_since_epoch();
+  server.create_buffers(type, num_buffers, rgb, width, height);
+  double alloc_ms = (nanos_since_epoch() - start) / 1e6;
+
+  // The first write to each buffer faults its pages in
+  start = nanos_since_epoch();
+  for (size_t i = 0; i < num_buffers; i++) {
+    VisionBuf *buf = server.get_buffer(type);
+    memset(buf->addr, 0, buf->len);
+  }
+  double fault_ms = (nanos_since_epoch() - start) / 1e6;
+  server.start_listener();
+
+  std::atomic<bool> ready = false, backed = false;
+  std::atomic<int> received = 0;
+  std::vector<uint64_t> read_times;
+  std::thread reader([&]() {
+    pin_to_core(1);
+
+    VisionIpcClient client("camerad", type, false);
+    client.connect();
+    backed = is_hugepage_backed(client.buffers[0].fd);
+    ready = true;
+
+    uint64_t sum = 0;
+    while (received < num_frames) {
+      VisionBuf *buf = client.recv();
+      if (buf == nullptr) continue;
+
+      uint64_t t = nanos_since_epoch();
+      const uint64_t *p = (const uint64_t *)buf->addr;
+      for (size_t i = 0; i < buf->len / sizeof(uint64_t); i++) {
+        sum += p[i];
+      }
+      read_times.push_back(nanos_since_epoch() - t);
+      client.release();
+      received++;
+    }
+    // Keeps the reads from being optimized away
+    if (sum == 42) printf("\n");
+  });
+
+  pin_to_core(0);
+  while (!ready) std::this_thread::yield();
+
+  std::vector<uint64_t> write_times;
+  size_t len = 0;
+  start = nanos_since_epoch();
+  for (int i = 0; i < num_frames; i++) {
+    while (i - received >= (int)num_buffers / 2) std::this_thread::yield();
+
+    VisionBuf *buf = server.get_buffer(type);
+    uint64_t t = nanos_since_epoch();
+    memset(buf->addr, i, buf->len);
+    write_times.push_back(nanos_since_epoch() - t);
+    len = buf->len;
+
+    VisionIpcBufExtra extra = {(uint32_t)i};
+    server.send(buf, &extra, false);
+  }
+  reader.join();
+  double elapsed = (nanos_since_epoch() - start) / 1e9;
+
+  char out[512];
+  snprintf(out, sizeof(out), "{\"hugepages\": %s, \"hugepage_backed\": %s, \"rgb\": %s, \"width\": %zu, \"height\": %zu, "
+           "\"alloc_ms\": %.2f, \"fault_ms\": %.2f, \"frames_per_s\": %.0f, \"gb_per_s\": %.2f, "
+           "\"write_p50_us\": %.1f, \"read_p50_us\": %.1f}",
+           hugepages ? "true" : "false", backed ? "true" : "false", rgb ? "true" : "false", width, height,
+           alloc_ms, fault_ms, num_frames / elapsed, 2.0 * len * num_frames / elapsed / 1e9,
+           percentile(write_times, 0.5) / 1e3, percentile(read_times, 0.5) / 1e3);
+  return out;
+}
+
+int main(int argc, char** argv) {
+  // The server and client log to std::cout, stdout only gets the results
+  std::cout.rdbuf(nullptr);
+
+  std::vector<std::string> throughput;
+  for (bool hugepages : {false, true}) {
+    throughput.push_back(bench_throughput(hugepages, false, 1164, 874, 20, 2000));
+    throughput.push_back(bench_throughput(hugepages, false, 1928, 1208, 20, 2000));
+    throughput.push_back(bench_throughput(hugepages, true, 1928, 1208, 4, 1000));
+  }
+
+  printf("{\n");
+  printf("  \"throughput\": %s\n", join(throughput).c_str());
+  printf("}\n");
+  return 0;
+}
@@ -1,5 +1,10 @@
+#include <atomic>
 #include <chrono>
 #include <cassert>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <thread>
 
@@ -7,6 +12,17 @@
 #include "visionipc_client.h"
 #include "visionipc_server.h"
 
+static std::string process_name() {
+#ifdef __APPLE__
+  return getprogname();
+#else
+  std::string name;
+  std::ifstream f("/proc/self/comm");
+  std::getline(f, name);
+  return name;
+#endif
+}
+
 VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx) {
   msg_ctx = Context::create();
   sock = SubSocket::create(msg_ctx, get_endpoint_name(name, type), "127.0.0.1", conflate, false);
@@ -24,6 +40,7 @@ bool VisionIpcClient::connect(bool blocking){
     buffers[i].free();
   }
   num_buffers = 0;
+  free_lease();
 
   // Connect to server socket and ask for all FDs of type
   std::string path = "/tmp/visionipc_" + name;
@@ -49,8 +66,11 @@ bool VisionIpcClient::connect(bool blocking){
   // Get FDs
   int fds[VISIONIPC_MAX_FDS];
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
+  int num_fds = 0;
+  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_fds);
 
+  // The last fd is the lease table
+  num_buffers = num_fds - 1;
   assert(num_buffers > 0);
   assert(r == sizeof(VisionBuf) * num_buffers);
 
@@ -59,15 +79,41 @@ bool VisionIpcClient::connect(bool blocking){
     buffers[i] = bufs[i];
     buffers[i].fd = fds[i];
     buffers[i].import();
+    // The layout comes from the server, the plane pointers are set up again in this address space
     if (buffers[i].rgb) {
       buffers[i].init_rgb(buffers[i].width, buffers[i].height, buffers[i].stride);
     } else {
-      buffers[i].init_yuv(buffers[i].width, buffers[i].height);
+      buffers[i].init_yuv(buffers[i].width, buffers[i].height, buffers[i].stride, buffers[i].uv_offset, buffers[i].nv12);
     }
 
     if (device_id) buffers[i].init_cl(device_id, ctx);
   }
 
+  lease_buf.fd = fds[num_buffers];
+  lease_buf.len = lease_buf.mmap_len = sizeof(VisionIpcLeaseTable);
+  lease_buf.import();
+  lease_table = (VisionIpcLeaseTable *)lease_buf.addr;
+
+  // Take a slot in the lease table, without one the buffers are used unprotected like before
+  static std::atomic<uint32_t> client_count = 0;
+  uint64_t uid = ((uint64_t)getpid() << 32) | ++client_count;
+  VisionIpcLeaseTable *t = lease_table;
+  for (auto &c : t->clients) {
+    uint64_t free_uid = 0;
+    if (c.uid.compare_exchange_strong(free_uid, uid)) {
+      snprintf(c.name, sizeof(c.name), "%s", process_name().c_str());
+      c.drops = 0;
+      c.max_held = 0;
+      c.connect_seq = t->seq.load();
+      c.released = c.connect_seq.load();
+      lease = &c;
+      break;
+    }
+  }
+  if (lease == nullptr) {
+    std::cout << "VisionIpcClient no free lease slot for " << name << " " << type << std::endl;
+  }
+
   connected = true;
   return true;
 }
@@ -97,6 +143,20 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     return nullptr;
   }
 
+  // Done with the packets before this one, its buffer is held until the next recv or release()
+  last_seq = packet->seq;
+  last_idx = packet->idx;
+  if (lease) {
+    lease->released = last_seq - 1;
+  }
+
+  // The buffer already holds a newer frame, or is being written, when this client fell behind
+  if (lease_table->buf_seq[packet->idx] != packet->seq) {
+    release();
+    delete r;
+    return nullptr;
+  }
+
   if (extra) {
     *extra = packet->extra;
   }
@@ -106,12 +166,32 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
   return buf;
 }
 
+bool VisionIpcClient::release(){
+  bool intact = lease_table == nullptr || lease_table->buf_seq[last_idx] == last_seq;
+  if (lease) {
+    lease->released = last_seq;
+  }
+  return intact;
+}
 
+void VisionIpcClient::free_lease(){
+  if (lease) {
+    lease->released = UINT64_MAX;
+    lease->uid = 0;
+    lease = nullptr;
+  }
+  if (lease_buf.addr) {
+    lease_buf.free();
+    lease_buf = VisionBuf();
+  }
+  lease_table = nullptr;
+}
 
 VisionIpcClient::~VisionIpcClient(){
   for (size_t i = 0; i < num_buffers; i++){
     buffers[i].free();
   }
+  free_lease();
 
   delete sock;
   delete poller;
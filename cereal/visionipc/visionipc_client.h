@@ -19,7 +19,14 @@ private:
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
+  VisionBuf lease_buf;
+  VisionIpcLeaseTable *lease_table = nullptr;
+  VisionIpcLease *lease = nullptr;
+  uint64_t last_seq = 0;
+  size_t last_idx = 0;
+
   void init_msgq(bool conflate);
+  void free_lease();
 
 public:
   bool connected = false;
@@ -27,6 +34,10 @@ public:
   VisionBuf buffers[VISIONIPC_MAX_FDS];
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
+  // Returns nullptr on timeout, and for a packet whose buffer was already overwritten by a newer one
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
   bool connect(bool blocking=true);
+  // The last received buffer is held until the next recv, release() hands it back earlier.
+  // Returns false if the server overwrote the buffer while it was held, after a drop
+  bool release();
 };
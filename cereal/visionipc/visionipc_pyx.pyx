@@ -18,6 +18,12 @@ cpdef enum VisionStreamType:
   VISION_STREAM_YUV_BACK
   VISION_STREAM_YUV_FRONT
   VISION_STREAM_YUV_WIDE
+  VISION_STREAM_YUV_BACK_HALF
+  VISION_STREAM_YUV_BACK_QUARTER
+  VISION_STREAM_YUV_FRONT_CROP
+  VISION_STREAM_NV12_BACK
+  VISION_STREAM_NV12_FRONT
+  VISION_STREAM_NV12_WIDE
 
 cdef class VisionIpcServer:
   cdef cppVisionIpcServer * server
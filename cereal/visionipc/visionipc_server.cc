@@ -1,6 +1,10 @@
 #include <iostream>
+#include <algorithm>
 #include <chrono>
 #include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <random>
 
 #include <poll.h>
@@ -20,6 +24,29 @@ std::string get_endpoint_name(std::string name, VisionStreamType type){
   }
 }
 
+static const char *DERIVE_KERNELS = R"(
+__kernel void halve(__global const uchar *src, int src_offset, int src_stride,
+                    __global uchar *dst, int dst_offset, int dst_stride) {
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  __global const uchar *s = src + src_offset + 2 * y * src_stride + 2 * x;
+  dst[dst_offset + y * dst_stride + x] = (s[0] + s[1] + s[src_stride] + s[src_stride + 1] + 2) >> 2;
+}
+
+__kernel void crop(__global const uchar *src, int src_offset, int src_stride,
+                   __global uchar *dst, int dst_offset, int dst_stride, int mirror) {
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  const int src_x = mirror ? get_global_size(0) - 1 - x : x;
+  dst[dst_offset + y * dst_stride + x] = src[src_offset + y * src_stride + src_x];
+}
+)";
+
+// A client holds a buffer until it released the packet that was last sent in it
+static bool is_held(const VisionIpcLease &c, uint64_t buf_seq) {
+  return c.uid != 0 && buf_seq > c.released;
+}
+
 VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_context ctx) : name(name), device_id(device_id), ctx(ctx) {
   msg_ctx = Context::create();
 
@@ -28,20 +55,22 @@ VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_co
   server_id = distribution(rd);
 }
 
-void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height){
+void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height, bool nv12){
   // TODO: assert that this type is not created yet
   assert(num_buffers < VISIONIPC_MAX_FDS);
+  assert(!(rgb && nv12));
   int aligned_w = 0, aligned_h = 0;
 
   size_t size = 0;
-  size_t stride = 0; // Only used for RGB
+  size_t stride = 0;
+  size_t uv_offset = 0; // Only used for YUV
 
   if (rgb) {
     visionbuf_compute_aligned_width_and_height(width, height, &aligned_w, &aligned_h);
     size = (size_t)aligned_w * (size_t)aligned_h * 3;
     stride = aligned_w * 3;
   } else {
-    size = width * height * 3 / 2;
+    visionbuf_compute_yuv_layout(width, height, nv12, &stride, &uv_offset, &size);
   }
 
 
@@ -54,18 +83,118 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
 
     if (device_id) buf->init_cl(device_id, ctx);
 
-    rgb ? buf->init_rgb(width, height, stride) : buf->init_yuv(width, height);
+    rgb ? buf->init_rgb(width, height, stride) : buf->init_yuv(width, height, stride, uv_offset, nv12);
 
     buffers[type].push_back(buf);
   }
 
   cur_idx[type] = 0;
+  last_sent[type] = nullptr;
+
+  // The lease table is shared with the clients together with the buffers
+  VisionBuf *lease_buf = new VisionBuf();
+  lease_buf->allocate(sizeof(VisionIpcLeaseTable));
+  VisionIpcLeaseTable *t = (VisionIpcLeaseTable *)lease_buf->addr;
+  for (auto &c : t->clients) {
+    c.released = UINT64_MAX;
+  }
+  lease_bufs[type] = lease_buf;
+  leases[type] = t;
 
   // Create msgq publisher for each of the `name` + type combos
   // TODO: compute port number directly if using zmq
   sockets[type] = PubSocket::create(msg_ctx, get_endpoint_name(name, type), false);
 }
 
+// The pyramid is built by halving a stream again, e.g. a quarter size stream from a half size one
+void VisionIpcServer::create_scaled_buffers(VisionStreamType type, size_t num_buffers, VisionStreamType source){
+  assert(buffers.count(source));
+  const VisionBuf *src = buffers[source][0];
+  assert(!src->rgb && !src->nv12);
+
+  create_buffers(type, num_buffers, false, (src->width / 2) & ~1, (src->height / 2) & ~1);
+  derived_streams[source].push_back({type, false, 0, 0, false});
+  init_derive_kernels();
+}
+
+// The chroma planes are cropped at half the coordinates, rounded down
+void VisionIpcServer::create_crop_buffers(VisionStreamType type, size_t num_buffers, VisionStreamType source,
+                                          size_t x, size_t y, size_t width, size_t height, bool mirror){
+  assert(buffers.count(source));
+  const VisionBuf *src = buffers[source][0];
+  assert(!src->rgb && !src->nv12);
+  assert(x + width <= src->width && y + height <= src->height);
+
+  create_buffers(type, num_buffers, false, width, height);
+  derived_streams[source].push_back({type, true, x, y, mirror});
+  init_derive_kernels();
+}
+
+void VisionIpcServer::init_derive_kernels(){
+  if (device_id == nullptr || halve_krnl != nullptr) return;
+
+  int err;
+  cl_program prg = clCreateProgramWithSource(ctx, 1, &DERIVE_KERNELS, NULL, &err);
+  assert(err == 0);
+  err = clBuildProgram(prg, 1, &device_id, "-cl-fast-relaxed-math", NULL, NULL);
+  assert(err == 0);
+  halve_krnl = clCreateKernel(prg, "halve", &err);
+  assert(err == 0);
+  crop_krnl = clCreateKernel(prg, "crop", &err);
+  assert(err == 0);
+  clReleaseProgram(prg);
+
+  derive_q = clCreateCommandQueue(ctx, device_id, 0, &err);
+  assert(err == 0);
+}
+
+void VisionIpcServer::derive(VisionBuf * src, VisionBuf * dst, const DerivedStream &d, bool on_device){
+  const uint8_t *src_planes[] = {src->y, src->u, src->v};
+  const uint8_t *dst_planes[] = {dst->y, dst->u, dst->v};
+
+  for (int i = 0; i < 3; i++) {
+    const int shift = i == 0 ? 0 : 1;
+    const int src_stride = i == 0 ? src->stride : src->uv_stride;
+    const int dst_stride = i == 0 ? dst->stride : dst->uv_stride;
+    const size_t work_size[] = {dst->width >> shift, dst->height >> shift};
+    const uint8_t *src_plane = src_planes[i] + (d.y >> shift) * src_stride + (d.x >> shift);
+
+    if (on_device) {
+      const int src_offset = src_plane - src->y, dst_offset = dst_planes[i] - dst->y;
+      cl_kernel krnl = d.crop ? crop_krnl : halve_krnl;
+      int err = clSetKernelArg(krnl, 0, sizeof(cl_mem), &src->buf_cl);
+      err |= clSetKernelArg(krnl, 1, sizeof(int), &src_offset);
+      err |= clSetKernelArg(krnl, 2, sizeof(int), &src_stride);
+      err |= clSetKernelArg(krnl, 3, sizeof(cl_mem), &dst->buf_cl);
+      err |= clSetKernelArg(krnl, 4, sizeof(int), &dst_offset);
+      err |= clSetKernelArg(krnl, 5, sizeof(int), &dst_stride);
+      if (d.crop) {
+        const int mirror = d.mirror;
+        err |= clSetKernelArg(krnl, 6, sizeof(int), &mirror);
+      }
+      err |= clEnqueueNDRangeKernel(derive_q, krnl, 2, NULL, work_size, NULL, 0, NULL, NULL);
+      assert(err == 0);
+    } else if (d.crop) {
+      visionbuf_crop_plane(src_plane, src_stride, (uint8_t *)dst_planes[i], dst_stride, work_size[0], work_size[1], d.mirror);
+    } else {
+      visionbuf_halve_plane(src_plane, src_stride, (uint8_t *)dst_planes[i], dst_stride, work_size[0], work_size[1]);
+    }
+  }
+}
+
+// Fills the streams derived from src and the ones derived from those. On the device the kernels
+// are only queued, the queue runs them in order so a level reads the one before it once it's done
+void VisionIpcServer::derive_all(VisionBuf * src, bool on_device){
+  auto derived = derived_streams.find(src->type);
+  if (derived == derived_streams.end()) return;
+
+  for (const DerivedStream &d : derived->second) {
+    VisionBuf *dst = get_buffer(d.type);
+    derive(src, dst, d, on_device);
+    derived_bufs.push_back(dst);
+    derive_all(dst, on_device);
+  }
+}
 
 void VisionIpcServer::start_listener(){
   listener_thread = std::thread(&VisionIpcServer::listener, this);
@@ -85,6 +214,8 @@ void VisionIpcServer::listener(){
     polls[0].fd = sock;
     polls[0].events = POLLIN;
 
+    free_dead_leases();
+
     int ret = poll(polls, 1, 100);
     if (ret < 0) {
       if (errno == EINTR || errno == EAGAIN) continue;
@@ -127,7 +258,10 @@ void VisionIpcServer::listener(){
       bufs[i].server_id = server_id;
     }
 
-    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds, nullptr);
+    // The lease table goes last
+    fds[num_fds] = lease_bufs[type]->fd;
+
+    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds + 1, nullptr);
 
     close(fd);
   }
@@ -138,25 +272,117 @@ void VisionIpcServer::listener(){
 
 
 
+// Frees the lease slots of clients that exited without releasing them
+void VisionIpcServer::free_dead_leases(){
+  for (auto const& [type, t] : leases) {
+    for (auto &c : t->clients) {
+      uint64_t uid = c.uid;
+      if (uid != 0 && kill((pid_t)(uid >> 32), 0) != 0 && errno == ESRCH) {
+        c.released = UINT64_MAX;
+        c.uid.compare_exchange_strong(uid, 0);
+      }
+    }
+  }
+}
+
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type){
-  // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
-  return b[cur_idx[type]++ % b.size()];
+  auto &b = buffers[type];
+  VisionIpcLeaseTable *t = leases[type];
+
+  // Round robin over the buffers that no client holds
+  size_t idx = cur_idx[type];
+  for (size_t i = 0; i < b.size(); i++, idx++) {
+    uint64_t buf_seq = t->buf_seq[idx % b.size()];
+    if (std::none_of(std::begin(t->clients), std::end(t->clients), [=](auto &c) { return is_held(c, buf_seq); })) {
+      // Clients that still get a packet of this buffer see that it is being overwritten
+      t->buf_seq[idx % b.size()] = 0;
+      cur_idx[type] = idx + 1;
+      return b[idx % b.size()];
+    }
+  }
+
+  // All of them are held, the oldest one is overwritten. That's a drop for every client holding it
+  size_t oldest = 0;
+  for (size_t i = 1; i < b.size(); i++) {
+    if (t->buf_seq[i] < t->buf_seq[oldest]) oldest = i;
+  }
+  for (auto &c : t->clients) {
+    if (is_held(c, t->buf_seq[oldest])) c.drops++;
+  }
+  t->buf_seq[oldest] = 0;
+  cur_idx[type] = oldest + 1;
+  return b[oldest];
 }
 
 void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
   if (sync) buf->sync(VISIONBUF_SYNC_FROM_DEVICE);
   assert(buffers.count(buf->type));
   assert(buf->idx < buffers[buf->type].size());
+  publish(buf, extra);
+
+  // Derived streams follow, so clients of the source don't wait for them. A buffer that was synced from
+  // the device is read on the device, all derived buffers of the server have a device copy too
+  derived_bufs.clear();
+  bool on_device = sync && halve_krnl && buf->buf_cl;
+  derive_all(buf, on_device);
+  if (on_device && !derived_bufs.empty()) clFinish(derive_q);
+
+  for (VisionBuf *dst : derived_bufs) {
+    if (on_device) dst->sync(VISIONBUF_SYNC_FROM_DEVICE);
+    publish(dst, extra);
+  }
+}
+
+void VisionIpcServer::publish(VisionBuf * buf, VisionIpcBufExtra * extra){
+  VisionIpcLeaseTable *t = leases[buf->type];
+  uint64_t seq = t->seq + 1;
+  t->buf_seq[buf->idx] = seq;
+  t->seq = seq;
+
+  for (auto &c : t->clients) {
+    if (c.uid == 0) continue;
+    uint64_t held = std::min<uint64_t>(seq - std::min<uint64_t>(seq, c.released), buffers[buf->type].size());
+    if (held > c.max_held) c.max_held = held;
+  }
 
   // Send over correct msgq socket
   VisionIpcPacket packet = {0};
   packet.server_id = server_id;
   packet.idx = buf->idx;
   packet.extra = *extra;
+  packet.seq = seq;
 
   sockets[buf->type]->send((char*)&packet, sizeof(packet));
+  last_sent[buf->type] = buf;
+}
+
+// The buffer of the last packet sent on a stream, it is overwritten by the next get_buffer at the earliest
+VisionBuf * VisionIpcServer::get_last_sent(VisionStreamType type){
+  assert(last_sent.count(type));
+  return last_sent[type];
+}
+
+std::vector<VisionIpcClientStats> VisionIpcServer::get_client_stats(){
+  std::vector<VisionIpcClientStats> stats;
+  for (auto const& [type, t] : leases) {
+    for (auto &c : t->clients) {
+      uint64_t uid = c.uid;
+      if (uid == 0) continue;
+
+      uint64_t seq = t->seq;
+      stats.push_back({
+        std::string(c.name, strnlen(c.name, sizeof(c.name))),
+        (int)(uid >> 32),
+        type,
+        buffers[type].size(),
+        seq - std::min<uint64_t>(seq, c.connect_seq),
+        c.drops,
+        c.max_held.exchange(0),
+      });
+    }
+  }
+  return stats;
 }
 
 VisionIpcServer::~VisionIpcServer(){
@@ -170,6 +396,15 @@ VisionIpcServer::~VisionIpcServer(){
       delete b;
     }
   }
+  for( auto const& [type, b] : lease_bufs ) {
+    b->free();
+    delete b;
+  }
+  if (halve_krnl) {
+    clReleaseKernel(halve_krnl);
+    clReleaseKernel(crop_krnl);
+    clReleaseCommandQueue(derive_q);
+  }
 
   // Messaging cleanup
   for( auto const& [type, sock] : sockets ) {
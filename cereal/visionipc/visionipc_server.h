@@ -11,6 +11,16 @@
 
 std::string get_endpoint_name(std::string name, VisionStreamType type);
 
+struct VisionIpcClientStats {
+  std::string name;
+  int pid;
+  VisionStreamType type;
+  size_t num_buffers;
+  uint64_t frames;  // sent since the client connected
+  uint64_t drops;  // buffers overwritten while the client held them
+  uint32_t max_held;  // most buffers held at once since the last call
+};
+
 class VisionIpcServer {
  private:
   cl_device_id device_id = nullptr;
@@ -24,11 +34,32 @@ class VisionIpcServer {
   std::map<VisionStreamType, std::atomic<size_t> > cur_idx;
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
   std::map<VisionStreamType, std::map<VisionBuf*, size_t> > idxs;
+  std::map<VisionStreamType, VisionBuf*> lease_bufs;
+  std::map<VisionStreamType, VisionIpcLeaseTable*> leases;
+  std::map<VisionStreamType, VisionBuf*> last_sent;
+
+  // Streams filled from a source stream when it is sent, scaled to half size or cropped
+  struct DerivedStream {
+    VisionStreamType type;
+    bool crop;
+    size_t x, y;  // top left corner of the crop
+    bool mirror;
+  };
+  std::map<VisionStreamType, std::vector<DerivedStream> > derived_streams;
+  cl_command_queue derive_q = nullptr;
+  cl_kernel halve_krnl = nullptr;
+  cl_kernel crop_krnl = nullptr;
+  std::vector<VisionBuf*> derived_bufs;  // filled by the last send, in the order they are published
 
   Context * msg_ctx;
   std::map<VisionStreamType, PubSocket*> sockets;
 
   void listener(void);
+  void free_dead_leases();
+  void init_derive_kernels();
+  void derive(VisionBuf * src, VisionBuf * dst, const DerivedStream &d, bool on_device);
+  void derive_all(VisionBuf * src, bool on_device);
+  void publish(VisionBuf * buf, VisionIpcBufExtra * extra);
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
@@ -36,7 +67,12 @@ class VisionIpcServer {
 
   VisionBuf * get_buffer(VisionStreamType type);
 
-  void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height);
+  void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height, bool nv12=false);
+  void create_scaled_buffers(VisionStreamType type, size_t num_buffers, VisionStreamType source);
+  void create_crop_buffers(VisionStreamType type, size_t num_buffers, VisionStreamType source,
+                           size_t x, size_t y, size_t width, size_t height, bool mirror=false);
+  VisionBuf * get_last_sent(VisionStreamType type);
   void send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync=true);
   void start_listener();
+  std::vector<VisionIpcClientStats> get_client_stats();
 };
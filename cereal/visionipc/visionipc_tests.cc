@@ -1,3 +1,4 @@
+#include <cstring>
 #include <thread>
 #include <chrono>
 
@@ -81,21 +82,18 @@ TEST_CASE("Send single buffer"){
 
 TEST_CASE("Test no conflate"){
   VisionIpcServer server("camerad");
-  server.create_buffers(VISION_STREAM_YUV_BACK, 1, true, 100, 100);
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, true, 100, 100);
   server.start_listener();
 
   VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
   REQUIRE(client.connect());
   zmq_sleep();
 
-  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
-  REQUIRE(buf != nullptr);
-
   VisionIpcBufExtra extra = {0};
   extra.frame_id = 1;
-  server.send(buf, &extra);
+  server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
   extra.frame_id = 2;
-  server.send(buf, &extra);
+  server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
 
   VisionIpcBufExtra extra_recv = {0};
   VisionBuf * recv_buf = client.recv(&extra_recv);
@@ -133,3 +131,235 @@ TEST_CASE("Test conflate"){
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Buffer leasing"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionIpcBufExtra extra = {0};
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+  server.send(buf, &extra);
+  VisionBuf * recv_buf = client.recv();
+  REQUIRE(recv_buf != nullptr);
+  REQUIRE(recv_buf->idx == buf->idx);
+
+  SECTION("held buffers are skipped"){
+    VisionBuf * next = server.get_buffer(VISION_STREAM_YUV_BACK);
+    REQUIRE(next->idx != buf->idx);
+    server.send(next, &extra);
+
+    // Both buffers are held now, one received and one queued. The oldest one is overwritten
+    REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK)->idx == buf->idx);
+    auto stats = server.get_client_stats();
+    REQUIRE(stats.size() == 1);
+    REQUIRE(stats[0].pid == getpid());
+    REQUIRE(stats[0].num_buffers == 2);
+    REQUIRE(stats[0].frames == 2);
+    REQUIRE(stats[0].drops == 1);
+    REQUIRE(stats[0].max_held == 2);
+    REQUIRE(server.get_client_stats()[0].max_held == 0);
+  }
+
+  SECTION("released buffers are reused"){
+    client.release();
+    REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK)->idx != buf->idx);
+    REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK)->idx == buf->idx);
+    REQUIRE(server.get_client_stats()[0].drops == 0);
+  }
+
+  SECTION("overwritten buffers are dropped"){
+    client.release();
+    VisionBuf * next = server.get_buffer(VISION_STREAM_YUV_BACK);
+    server.send(next, &extra);
+    server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+
+    // Both packets are queued, the older one is overwritten before the client gets to it
+    REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK) == next);
+    server.send(next, &extra);
+    REQUIRE(client.recv() == nullptr);
+    REQUIRE(client.recv() == &client.buffers[buf->idx]);
+
+    // The one it holds is overwritten next
+    REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK) == buf);
+    REQUIRE_FALSE(client.release());
+    server.send(buf, &extra);
+    REQUIRE(client.recv() == &client.buffers[next->idx]);
+    REQUIRE(client.release());
+  }
+
+  SECTION("disconnected clients hold nothing"){
+    {
+      VisionIpcClient client2 = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+      REQUIRE(client2.connect());
+      REQUIRE(server.get_client_stats().size() == 2);
+    }
+    REQUIRE(server.get_client_stats().size() == 1);
+
+    client.release();
+    for (int i = 0; i < 4; i++) {
+      server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+      REQUIRE(client.recv() != nullptr);
+    }
+    REQUIRE(server.get_client_stats()[0].drops == 0);
+  }
+}
+
+TEST_CASE("Scaled streams"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, false, 100, 60);
+  server.create_scaled_buffers(VISION_STREAM_YUV_BACK_HALF, 2, VISION_STREAM_YUV_BACK);
+  server.create_scaled_buffers(VISION_STREAM_YUV_BACK_QUARTER, 2, VISION_STREAM_YUV_BACK_HALF);
+  server.start_listener();
+
+  VisionIpcClient client_half = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK_HALF, false);
+  VisionIpcClient client_quarter = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK_QUARTER, false);
+  REQUIRE(client_half.connect());
+  REQUIRE(client_quarter.connect());
+  zmq_sleep();
+
+  REQUIRE(client_half.buffers[0].width == 50);
+  REQUIRE(client_half.buffers[0].height == 30);
+  REQUIRE(client_quarter.buffers[0].width == 24);
+  REQUIRE(client_quarter.buffers[0].height == 14);
+
+  // Columns alternate between 0 and 200, rows between +0 and +20
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+  for (size_t y = 0; y < buf->height; y++) {
+    for (size_t x = 0; x < buf->width; x++) {
+      buf->y[y * buf->width + x] = (x % 2) * 200 + (y % 2) * 20;
+    }
+  }
+  memset(buf->u, 128, buf->width * buf->height / 4);
+  memset(buf->v, 64, buf->width * buf->height / 4);
+
+  VisionIpcBufExtra extra = {0};
+  extra.frame_id = 42;
+  server.send(buf, &extra);
+
+  VisionIpcBufExtra extra_recv = {0};
+  VisionBuf * half = client_half.recv(&extra_recv);
+  REQUIRE(half != nullptr);
+  REQUIRE(extra_recv.frame_id == 42);
+  for (size_t i = 0; i < half->width * half->height; i++) {
+    REQUIRE(half->y[i] == 110);
+  }
+  REQUIRE(half->u[half->width * half->height / 4 - 1] == 128);
+  REQUIRE(half->v[0] == 64);
+
+  VisionBuf * quarter = client_quarter.recv(&extra_recv);
+  REQUIRE(quarter != nullptr);
+  REQUIRE(extra_recv.frame_id == 42);
+  REQUIRE(quarter->y[quarter->width * quarter->height - 1] == 110);
+  REQUIRE(server.get_last_sent(VISION_STREAM_YUV_BACK_QUARTER)->y[0] == 110);
+}
+
+TEST_CASE("Crop streams"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_FRONT, 2, false, 100, 60);
+  bool mirror = GENERATE(false, true);
+  server.create_crop_buffers(VISION_STREAM_YUV_FRONT_CROP, 2, VISION_STREAM_YUV_FRONT, 40, 10, 36, 40, mirror);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_FRONT_CROP, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+  REQUIRE(client.buffers[0].width == 36);
+  REQUIRE(client.buffers[0].height == 40);
+
+  // Every pixel has the value of its column
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_FRONT);
+  for (size_t y = 0; y < buf->height; y++) {
+    for (size_t x = 0; x < buf->width; x++) {
+      buf->y[y * buf->width + x] = x;
+    }
+  }
+  for (size_t y = 0; y < buf->height / 2; y++) {
+    for (size_t x = 0; x < buf->width / 2; x++) {
+      buf->u[y * buf->width / 2 + x] = x;
+      buf->v[y * buf->width / 2 + x] = 100 + x;
+    }
+  }
+
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+
+  VisionBuf * crop = client.recv();
+  REQUIRE(crop != nullptr);
+  for (size_t y = 0; y < crop->height; y++) {
+    for (size_t x = 0; x < crop->width; x++) {
+      REQUIRE(crop->y[y * crop->width + x] == 40 + (mirror ? crop->width - 1 - x : x));
+    }
+  }
+  for (size_t x = 0; x < crop->width / 2; x++) {
+    size_t src_x = 20 + (mirror ? crop->width / 2 - 1 - x : x);
+    REQUIRE(crop->u[x] == src_x);
+    REQUIRE(crop->v[(crop->height / 2 - 1) * crop->width / 2 + x] == 100 + src_x);
+  }
+}
+
+TEST_CASE("NV12 layout"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 1, false, 100, 60);
+  server.create_buffers(VISION_STREAM_NV12_BACK, 1, false, 100, 60, true);
+  server.start_listener();
+
+  VisionIpcClient client_yuv = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  VisionIpcClient client_nv12 = VisionIpcClient("camerad", VISION_STREAM_NV12_BACK, false);
+  REQUIRE(client_yuv.connect());
+  REQUIRE(client_nv12.connect());
+  zmq_sleep();
+
+  VisionBuf &yuv = client_yuv.buffers[0];
+  REQUIRE(!yuv.nv12);
+  REQUIRE(yuv.u == yuv.y + yuv.uv_offset);
+  REQUIRE(yuv.v == yuv.u + yuv.uv_stride * 30);
+  REQUIRE(yuv.uv == nullptr);
+
+  // The client gets the server's layout, whatever alignment it has
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_NV12_BACK);
+  VisionBuf &nv12 = client_nv12.buffers[0];
+  REQUIRE(nv12.nv12);
+  REQUIRE(nv12.stride == buf->stride);
+  REQUIRE(nv12.stride >= 100);
+  REQUIRE(nv12.uv_offset == buf->uv_offset);
+  REQUIRE(nv12.uv_offset >= nv12.stride * 60);
+  REQUIRE(nv12.uv_stride == nv12.stride);
+  REQUIRE(nv12.uv_offset + nv12.uv_stride * 30 <= nv12.len);
+  REQUIRE(nv12.uv == nv12.y + nv12.uv_offset);
+  REQUIRE(nv12.u == nullptr);
+
+  buf->y[59 * buf->stride + 99] = 1;
+  buf->uv[29 * buf->uv_stride + 98] = 2;
+  buf->uv[29 * buf->uv_stride + 99] = 3;
+
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+
+  VisionBuf * recv_buf = client_nv12.recv();
+  REQUIRE(recv_buf != nullptr);
+  REQUIRE(recv_buf->y[59 * recv_buf->stride + 99] == 1);
+  REQUIRE(recv_buf->uv[29 * recv_buf->uv_stride + 98] == 2);
+  REQUIRE(recv_buf->uv[29 * recv_buf->uv_stride + 99] == 3);
+}
+
+#ifdef __linux__
+TEST_CASE("Clients can't resize buffers"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 1, false, 1164, 874);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+
+  VisionBuf &buf = client.buffers[0];
+  REQUIRE(buf.mmap_len >= buf.len);
+  REQUIRE(ftruncate(buf.fd, 0) != 0);
+  REQUIRE(ftruncate(buf.fd, buf.mmap_len * 2) != 0);
+  ((uint8_t *)buf.addr)[buf.len - 1] = 1;
+}
+#endif
@@ -1,6 +1,8 @@
 # distutils: language = c++
 # cython: language_level = 3
 from posix.time cimport clock_gettime, timespec, CLOCK_MONOTONIC_RAW, clockid_t
+from libc.stdint cimport uint64_t
+import time
 
 IF UNAME_SYSNAME == "Darwin":
   # Darwin doesn't have a CLOCK_BOOTTIME
@@ -8,6 +10,13 @@ IF UNAME_SYSNAME == "Darwin":
 ELSE:
   from posix.time cimport CLOCK_BOOTTIME
 
+cdef extern from "cereal/messaging/sim_clock.h":
+  cdef struct sim_clock_t:
+    pass
+  sim_clock_t *sim_clock()
+  uint64_t sim_clock_nanos(sim_clock_t *c)
+  void sim_clock_wait_until(sim_clock_t *c, uint64_t deadline) nogil
+
 cdef double readclock(clockid_t clock_id):
   cdef timespec ts
   cdef double current
@@ -20,5 +29,20 @@ def monotonic_time():
   return readclock(CLOCK_MONOTONIC_RAW)
 
 def sec_since_boot():
+  cdef sim_clock_t *c = sim_clock()
+  if c != NULL:
+    return sim_clock_nanos(c) * 1e-9
   return readclock(CLOCK_BOOTTIME)
 
+def sleep(double seconds):
+  """time.sleep, on the simulated clock when SIM_CLOCK=1"""
+  cdef sim_clock_t *c = sim_clock()
+  cdef uint64_t deadline
+  if c == NULL:
+    time.sleep(seconds)
+    return
+
+  deadline = sim_clock_nanos(c) + <uint64_t>(seconds * 1e9)
+  with nogil:
+    sim_clock_wait_until(c, deadline)
+
@@ -19,6 +19,7 @@
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/latency.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
@@ -179,11 +180,10 @@ static bool usb_retry_connect() {
   return !do_exit;
 }
 
-void can_recv(PubMaster &pm) {
-  kj::Array<capnp::word> can_data;
-  panda->can_receive(can_data);
-  auto bytes = can_data.asBytes();
-  pm.send("can", bytes.begin(), bytes.size());
+void can_recv(PubMaster &pm, ReusableMessageBuilder &builder) {
+  MessageBuilder &msg = builder.reset();
+  panda->can_receive(msg);
+  pm.send(ServiceId::can, msg);
 }
 
 void can_send_thread(bool fake_send) {
@@ -195,10 +195,19 @@ void can_send_thread(bool fake_send) {
   assert(subscriber != NULL);
   subscriber->setTimeout(100);
 
+  PubMaster pm({"latencyStats"});
+  LatencyStages latency("boardd", {"sendcan->usb"});
+  uint64_t last_latency_publish = nanos_since_boot();
+
   // run as fast as messages come in
   while (!do_exit && panda->connected) {
     Message * msg = subscriber->receive();
 
+    if (nanos_since_boot() - last_latency_publish >= 1e9) {
+      latency.publish(pm);
+      last_latency_publish = nanos_since_boot();
+    }
+
     if (!msg) {
       if (errno == EINTR) {
         do_exit = true;
@@ -213,6 +222,7 @@ void can_send_thread(bool fake_send) {
     if (nanos_since_boot() - event.getLogMonoTime() < 1e9) {
       if (!fake_send) {
         panda->can_send(event.getSendcan());
+        latency.add(0, event.getLogMonoTime(), nanos_since_boot());
       }
     }
 
@@ -228,18 +238,19 @@ void can_recv_thread() {
 
   // can = 8006
   PubMaster pm({"can"});
+  ReusableMessageBuilder builder;
 
   // run at 100hz
   const uint64_t dt = 10000000ULL;
   uint64_t next_frame_time = nanos_since_boot() + dt;
 
   while (!do_exit && panda->connected) {
-    can_recv(pm);
+    can_recv(pm, builder);
 
     uint64_t cur_time = nanos_since_boot();
     int64_t remaining = next_frame_time - cur_time;
     if (remaining > 0) {
-      std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
+      sleep_until_nanos(next_frame_time);
     } else {
       if (ignition) {
         LOGW("missed cycles (%d) %lld", (int)-1*remaining/dt, remaining);
@@ -265,7 +276,7 @@ void panda_state_thread(bool spoofing_started) {
     auto pandaState  = msg.initEvent().initPandaState();
 
     pandaState.setPandaType(cereal::PandaState::PandaType::UNKNOWN);
-    pm.send("pandaState", msg);
+    pm.send(ServiceId::pandaState, msg);
     util::sleep_for(500);
   }
 
@@ -394,7 +405,7 @@ void panda_state_thread(bool spoofing_started) {
         i++;
       }
     }
-    pm.send("pandaState", msg);
+    pm.send(ServiceId::pandaState, msg);
     panda->send_heartbeat();
     util::sleep_for(500);
   }
@@ -415,9 +426,9 @@ void hardware_control_thread() {
     cnt++;
     sm.update(1000); // TODO: what happens if EINTR is sent while in sm.update?
 
-    if (!Hardware::PC() && sm.updated("deviceState")) {
+    if (!Hardware::PC() && sm.updated(ServiceId::deviceState)) {
       // Charging mode
-      bool charging_disabled = sm["deviceState"].getDeviceState().getChargingDisabled();
+      bool charging_disabled = sm[ServiceId::deviceState].getDeviceState().getChargingDisabled();
       if (charging_disabled != prev_charging_disabled) {
         if (charging_disabled) {
           panda->set_usb_power_mode(cereal::PandaState::UsbPowerMode::CLIENT);
@@ -432,16 +443,16 @@ void hardware_control_thread() {
 
     // Other pandas don't have fan/IR to control
     if (panda->hw_type != cereal::PandaState::PandaType::UNO && panda->hw_type != cereal::PandaState::PandaType::DOS) continue;
-    if (sm.updated("deviceState")) {
+    if (sm.updated(ServiceId::deviceState)) {
       // Fan speed
-      uint16_t fan_speed = sm["deviceState"].getDeviceState().getFanSpeedPercentDesired();
+      uint16_t fan_speed = sm[ServiceId::deviceState].getDeviceState().getFanSpeedPercentDesired();
       if (fan_speed != prev_fan_speed || cnt % 100 == 0) {
         panda->set_fan_speed(fan_speed);
         prev_fan_speed = fan_speed;
       }
     }
-    if (sm.updated("driverCameraState")) {
-      auto event = sm["driverCameraState"];
+    if (sm.updated(ServiceId::driverCameraState)) {
+      auto event = sm[ServiceId::driverCameraState];
       int cur_integ_lines = event.getDriverCameraState().getIntegLines();
       last_front_frame_t = event.getLogMonoTime();
 
@@ -471,7 +482,7 @@ static void pigeon_publish_raw(PubMaster &pm, const std::string &dat) {
   // create message
   MessageBuilder msg;
   msg.initEvent().setUbloxRaw(capnp::Data::Reader((uint8_t*)dat.data(), dat.length()));
-  pm.send("ubloxRaw", msg);
+  pm.send(ServiceId::ubloxRaw, msg);
 }
 
 void pigeon_thread() {
@@ -283,7 +283,7 @@ void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
   usb_bulk_write(3, (unsigned char*)send.data(), send.size(), 5);
 }
 
-int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
+int Panda::can_receive(MessageBuilder& msg) {
   uint32_t data[RECV_SIZE/4];
   int recv = usb_bulk_read(0x81, (unsigned char*)data, RECV_SIZE);
 
@@ -295,7 +295,6 @@ int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
   }
 
   size_t num_msg = recv / 0x10;
-  MessageBuilder msg;
   auto evt = msg.initEvent();
   evt.setValid(comms_healthy);
 
@@ -315,6 +314,5 @@ int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
     canData[i].setDat(kj::arrayPtr((uint8_t*)&data[i*4+2], len));
     canData[i].setSrc((data[i*4+1] >> 4) & 0xff);
   }
-  out_buf = capnp::messageToFlatArray(msg);
   return recv;
 }
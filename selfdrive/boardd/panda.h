@@ -11,6 +11,7 @@
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
+#include "cereal/messaging/messaging.h"
 
 // double the FIFO size
 #define RECV_SIZE (0x1000)
@@ -80,5 +81,5 @@ class Panda {
   void set_usb_power_mode(cereal::PandaState::UsbPowerMode power_mode);
   void send_heartbeat();
   void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
-  int can_receive(kj::Array<capnp::word>& out_buf);
+  int can_receive(MessageBuilder& msg);
 };
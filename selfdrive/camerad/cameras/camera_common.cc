@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <chrono>
 #include <thread>
+#include <vector>
 
 #include "libyuv.h"
 #include <jpeglib.h>
@@ -77,6 +78,20 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
   rgb_stride = vipc_server->get_buffer(rgb_type)->stride;
 
   vipc_server->create_buffers(yuv_type, YUV_COUNT, false, rgb_width, rgb_height);
+#if defined(QCOM) || defined(QCOM2)
+  // The hardware encoder of loggerd takes NV12 in its own alignment, it gets a stream of its own
+  nv12_type = yuv_type == VISION_STREAM_YUV_FRONT ? VISION_STREAM_NV12_FRONT :
+              (yuv_type == VISION_STREAM_YUV_WIDE ? VISION_STREAM_NV12_WIDE : VISION_STREAM_NV12_BACK);
+  vipc_server->create_buffers(nv12_type, NV12_COUNT, false, rgb_width, rgb_height, true);
+#endif
+  if (yuv_type == VISION_STREAM_YUV_BACK) {
+    vipc_server->create_scaled_buffers(VISION_STREAM_YUV_BACK_HALF, DERIVED_YUV_COUNT, yuv_type);
+    vipc_server->create_scaled_buffers(VISION_STREAM_YUV_BACK_QUARTER, DERIVED_YUV_COUNT, VISION_STREAM_YUV_BACK_HALF);
+  } else if (yuv_type == VISION_STREAM_YUV_FRONT) {
+    const DMonitoringCrop crop = get_dmonitoring_crop(rgb_width, rgb_height, Params().getBool("IsRHD"));
+    vipc_server->create_crop_buffers(VISION_STREAM_YUV_FRONT_CROP, DERIVED_YUV_COUNT, yuv_type,
+                                     crop.x, crop.y, crop.w, crop.h, crop.mirror);
+  }
 
   if (ci->bayer) {
     cl_program prg_debayer = build_debayer_program(device_id, context, ci, this, s);
@@ -84,7 +99,12 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
     CL_CHECK(clReleaseProgram(prg_debayer));
   }
 
-  rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride);
+  if (nv12_type != VISION_STREAM_MAX) {
+    const VisionBuf *nv12 = vipc_server->get_buffer(nv12_type);
+    rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride, nv12->stride, nv12->uv_offset);
+  } else {
+    rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride);
+  }
 
 #ifdef __APPLE__
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
@@ -147,7 +167,12 @@ bool CameraBuf::acquire() {
   CL_CHECK(clReleaseEvent(debayer_event));
 
   cur_yuv_buf = vipc_server->get_buffer(yuv_type);
-  rgb2yuv->queue(q, cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl);
+  if (nv12_type != VISION_STREAM_MAX) {
+    cur_nv12_buf = vipc_server->get_buffer(nv12_type);
+    rgb2yuv->queue(q, cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl, cur_nv12_buf->buf_cl);
+  } else {
+    rgb2yuv->queue(q, cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl);
+  }
 
   VisionIpcBufExtra extra = {
                         cur_frame_data.frame_id,
@@ -156,6 +181,12 @@ bool CameraBuf::acquire() {
   };
   vipc_server->send(cur_rgb_buf, &extra);
   vipc_server->send(cur_yuv_buf, &extra);
+  if (cur_nv12_buf) {
+    vipc_server->send(cur_nv12_buf, &extra);
+  }
+  if (yuv_type == VISION_STREAM_YUV_BACK) {
+    cur_yuv_quarter_buf = vipc_server->get_last_sent(VISION_STREAM_YUV_BACK_QUARTER);
+  }
 
   return true;
 }
@@ -215,11 +246,17 @@ kj::Array<uint8_t> get_frame_image(const CameraBuf *b) {
 }
 
 static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
+  // The quarter size stream camerad sends anyway is the thumbnail
+  const VisionBuf *yuv = b->cur_yuv_quarter_buf;
+  assert(yuv);
+
+  std::vector<uint8_t> rgb(yuv->width * yuv->height * 3);
+  libyuv::I420ToRAW(yuv->y, yuv->stride, yuv->u, yuv->uv_stride, yuv->v, yuv->uv_stride,
+                    rgb.data(), yuv->width * 3, yuv->width, yuv->height);
+
   uint8_t* thumbnail_buffer = NULL;
   unsigned long thumbnail_len = 0;
 
-  unsigned char *row = (unsigned char *)malloc(b->rgb_width/4*3);
-
   struct jpeg_compress_struct cinfo;
   struct jpeg_error_mgr jerr;
 
@@ -227,8 +264,8 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
   jpeg_create_compress(&cinfo);
   jpeg_mem_dest(&cinfo, &thumbnail_buffer, &thumbnail_len);
 
-  cinfo.image_width = b->rgb_width / 4;
-  cinfo.image_height = b->rgb_height / 4;
+  cinfo.image_width = yuv->width;
+  cinfo.image_height = yuv->height;
   cinfo.input_components = 3;
   cinfo.in_color_space = JCS_RGB;
 
@@ -242,29 +279,12 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
 #endif
 
   JSAMPROW row_pointer[1];
-  const uint8_t *bgr_ptr = (const uint8_t *)b->cur_rgb_buf->addr;
-  for (int ii = 0; ii < b->rgb_height/4; ii+=1) {
-    for (int j = 0; j < b->rgb_width*3; j+=12) {
-      for (int k = 0; k < 3; k++) {
-        uint16_t dat = 0;
-        int i = ii * 4;
-        dat += bgr_ptr[b->rgb_stride*i + j + k];
-        dat += bgr_ptr[b->rgb_stride*i + j+3 + k];
-        dat += bgr_ptr[b->rgb_stride*(i+1) + j + k];
-        dat += bgr_ptr[b->rgb_stride*(i+1) + j+3 + k];
-        dat += bgr_ptr[b->rgb_stride*(i+2) + j + k];
-        dat += bgr_ptr[b->rgb_stride*(i+2) + j+3 + k];
-        dat += bgr_ptr[b->rgb_stride*(i+3) + j + k];
-        dat += bgr_ptr[b->rgb_stride*(i+3) + j+3 + k];
-        row[(j/4) + (2-k)] = dat/8;
-      }
-    }
-    row_pointer[0] = row;
+  for (size_t i = 0; i < yuv->height; i++) {
+    row_pointer[0] = &rgb[i * yuv->width * 3];
     jpeg_write_scanlines(&cinfo, row_pointer, 1);
   }
   jpeg_finish_compress(&cinfo);
   jpeg_destroy_compress(&cinfo);
-  free(row);
 
   MessageBuilder msg;
   auto thumbnaild = msg.initEvent().initThumbnail();
@@ -272,7 +292,7 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
   thumbnaild.setTimestampEof(b->cur_frame_data.timestamp_eof);
   thumbnaild.setThumbnail(kj::arrayPtr((const uint8_t*)thumbnail_buffer, thumbnail_len));
 
-  pm->send("thumbnail", msg);
+  pm->send(ServiceId::thumbnail, msg);
   free(thumbnail_buffer);
 }
 
@@ -284,7 +304,7 @@ float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip
   unsigned int lum_total = 0;
   for (int y = y_start; y < y_end; y += y_skip) {
     for (int x = x_start; x < x_end; x += x_skip) {
-      uint8_t lum = pix_ptr[(y * b->rgb_width) + x];
+      uint8_t lum = pix_ptr[(y * b->cur_yuv_buf->stride) + x];
       lum_binning[lum]++;
       lum_total += 1;
     }
@@ -358,8 +378,8 @@ static void driver_cam_auto_exposure(CameraState *c, SubMaster &sm) {
 
   static ExpRect rect = def_rect;
   // use driver face crop for AE
-  if (sm.updated("driverState")) {
-    if (auto state = sm["driverState"].getDriverState(); state.getFaceProb() > 0.4) {
+  if (sm.updated(ServiceId::driverState)) {
+    if (auto state = sm[ServiceId::driverState].getDriverState(); state.getFaceProb() > 0.4) {
       auto face_position = state.getFacePosition();
       int x = is_rhd ? 0 : frame_width - (0.5 * frame_height);
       x += (face_position[0] * (is_rhd ? -1.0 : 1.0) + 0.5) * (0.5 * frame_height) + x_offset;
@@ -386,5 +406,5 @@ void common_process_driver_camera(SubMaster *sm, PubMaster *pm, CameraState *c,
   if (env_send_driver) {
     framed.setImage(get_frame_image(&c->buf));
   }
-  pm->send("driverCameraState", msg);
+  pm->send(ServiceId::driverCameraState, msg);
 }
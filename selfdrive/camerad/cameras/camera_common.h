@@ -28,6 +28,8 @@
 
 #define UI_BUF_COUNT 4
 #define YUV_COUNT 100
+#define DERIVED_YUV_COUNT 20
+#define NV12_COUNT 20
 #define LOG_CAMERA_ID_FCAMERA 0
 #define LOG_CAMERA_ID_DCAMERA 1
 #define LOG_CAMERA_ID_ECAMERA 2
@@ -104,6 +106,7 @@ private:
   std::unique_ptr<Rgb2Yuv> rgb2yuv;
 
   VisionStreamType rgb_type, yuv_type;
+  VisionStreamType nv12_type = VISION_STREAM_MAX;  // only with a hardware encoder
 
   int cur_buf_idx;
 
@@ -117,6 +120,8 @@ public:
   FrameMetadata cur_frame_data;
   VisionBuf *cur_rgb_buf;
   VisionBuf *cur_yuv_buf;
+  VisionBuf *cur_nv12_buf = nullptr;
+  VisionBuf *cur_yuv_quarter_buf = nullptr;  // only for the road camera
   std::unique_ptr<VisionBuf[]> camera_bufs;
   std::unique_ptr<FrameMetadata[]> camera_bufs_metadata;
   int rgb_width, rgb_height, rgb_stride;
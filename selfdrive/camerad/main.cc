@@ -27,6 +27,34 @@
 
 ExitHandler do_exit;
 
+// Publishes how many buffers every VisionIPC client holds and how often one was overwritten while
+// it held it, to size UI_BUF_COUNT and YUV_COUNT
+void vipc_stats_thread(VisionIpcServer *vipc_server) {
+  set_thread_name("vipc_stats");
+  PubMaster pm({"visionipcStats"});
+
+  for (int cnt = 1; !do_exit; cnt++) {
+    util::sleep_for(100);
+    if (cnt % 10 != 0) continue;
+
+    auto clients = vipc_server->get_client_stats();
+    MessageBuilder msg;
+    auto stats = msg.initEvent().initVisionipcStats();
+    stats.setServer("camerad");
+    auto clients_list = stats.initClients(clients.size());
+    for (size_t i = 0; i < clients.size(); i++) {
+      clients_list[i].setName(clients[i].name);
+      clients_list[i].setPid(clients[i].pid);
+      clients_list[i].setStreamType(clients[i].type);
+      clients_list[i].setNumBuffers(clients[i].num_buffers);
+      clients_list[i].setFrames(clients[i].frames);
+      clients_list[i].setDrops(clients[i].drops);
+      clients_list[i].setMaxHeld(clients[i].max_held);
+    }
+    pm.send(ServiceId::visionipcStats, msg);
+  }
+}
+
 void party(cl_device_id device_id, cl_context context) {
   MultiCameraState cameras = {};
   VisionIpcServer vipc_server("camerad", device_id, context);
@@ -35,8 +63,11 @@ void party(cl_device_id device_id, cl_context context) {
   cameras_open(&cameras);
 
   vipc_server.start_listener();
+  std::thread stats_thread(vipc_stats_thread, &vipc_server);
 
   cameras_run(&cameras);
+  do_exit = true;
+  stats_thread.join();
 }
 
 #ifdef QCOM
@@ -3,7 +3,13 @@
 #define RGB_TO_V(r, g, b) ((mul24(r, 56) - mul24(g, 47) - mul24(b, 9) + 0x8080) >> 8)
 #define AVERAGE(x, y, z, w) ((convert_ushort(x) + convert_ushort(y) + convert_ushort(z) + convert_ushort(w) + 1) >> 1)
 
-inline void convert_2_ys(__global uchar * out_yuv, int yi, const uchar8 rgbs1) {
+// With NV12_STRIDE set the pixels are also written to out_nv12, in the same pass
+#ifndef NV12_STRIDE
+#define NV12_STRIDE 0
+#define NV12_UV_OFFSET 0
+#endif
+
+inline void convert_2_ys(__global uchar * out_yuv, int yi, __global uchar * out_nv12, int nv12_yi, const uchar8 rgbs1) {
   uchar2 yy = (uchar2)(
     RGB_TO_Y(rgbs1.s2, rgbs1.s1, rgbs1.s0),
     RGB_TO_Y(rgbs1.s5, rgbs1.s4, rgbs1.s3)
@@ -13,9 +19,12 @@ inline void convert_2_ys(__global uchar * out_yuv, int yi, const uchar8 rgbs1) {
     printf("Y vector2 overflow, %d > %d\n", yi, RGB_SIZE);
 #endif
   vstore2(yy, 0, out_yuv + yi);
+#if NV12_STRIDE
+  vstore2(yy, 0, out_nv12 + nv12_yi);
+#endif
 }
 
-inline void convert_4_ys(__global uchar * out_yuv, int yi, const uchar8 rgbs1, const uchar8 rgbs3) {
+inline void convert_4_ys(__global uchar * out_yuv, int yi, __global uchar * out_nv12, int nv12_yi, const uchar8 rgbs1, const uchar8 rgbs3) {
   const uchar4 yy = (uchar4)(
     RGB_TO_Y(rgbs1.s2, rgbs1.s1, rgbs1.s0),
     RGB_TO_Y(rgbs1.s5, rgbs1.s4, rgbs1.s3),
@@ -27,9 +36,12 @@ inline void convert_4_ys(__global uchar * out_yuv, int yi, const uchar8 rgbs1, c
     printf("Y vector4 overflow, %d > %d\n", yi, RGB_SIZE - 4);
 #endif
   vstore4(yy, 0, out_yuv + yi);
+#if NV12_STRIDE
+  vstore4(yy, 0, out_nv12 + nv12_yi);
+#endif
 }
 
-inline void convert_uv(__global uchar * out_yuv, int ui, int vi,
+inline void convert_uv(__global uchar * out_yuv, int ui, int vi, __global uchar * out_nv12, int nv12_uvi,
                     const uchar8 rgbs1, const uchar8 rgbs2) {
   // U & V: average of 2x2 pixels square
   const short ab = AVERAGE(rgbs1.s0, rgbs1.s3, rgbs2.s0, rgbs2.s3);
@@ -41,11 +53,15 @@ inline void convert_uv(__global uchar * out_yuv, int ui, int vi,
   if(vi >= RGB_SIZE  + RGB_SIZE / 2)
     printf("V overflow, %d >= %d\n", vi, RGB_SIZE  + RGB_SIZE / 2);
 #endif
-  out_yuv[ui] = RGB_TO_U(ar, ag, ab);
-  out_yuv[vi] = RGB_TO_V(ar, ag, ab);
+  const uchar2 uv = (uchar2)(RGB_TO_U(ar, ag, ab), RGB_TO_V(ar, ag, ab));
+  out_yuv[ui] = uv.s0;
+  out_yuv[vi] = uv.s1;
+#if NV12_STRIDE
+  vstore2(uv, 0, out_nv12 + nv12_uvi);
+#endif
 }
 
-inline void convert_2_uvs(__global uchar * out_yuv, int ui, int vi,
+inline void convert_2_uvs(__global uchar * out_yuv, int ui, int vi, __global uchar * out_nv12, int nv12_uvi,
                     const uchar8 rgbs1, const uchar8 rgbs2, const uchar8 rgbs3, const uchar8 rgbs4) {
   // U & V: average of 2x2 pixels square
   const short ab1 = AVERAGE(rgbs1.s0, rgbs1.s3, rgbs2.s0, rgbs2.s3);
@@ -70,10 +86,14 @@ inline void convert_2_uvs(__global uchar * out_yuv, int ui, int vi,
 #endif
   vstore2(u2, 0, out_yuv + ui);
   vstore2(v2, 0, out_yuv + vi);
+#if NV12_STRIDE
+  vstore4((uchar4)(u2.s0, v2.s0, u2.s1, v2.s1), 0, out_nv12 + nv12_uvi);
+#endif
 }
 
 __kernel void rgb_to_yuv(__global uchar const * const rgb,
-                    __global uchar * out_yuv)
+                    __global uchar * out_yuv,
+                    __global uchar * out_nv12)
 {
   const int dx = get_global_id(0);
   const int dy = get_global_id(1);
@@ -83,6 +103,8 @@ __kernel void rgb_to_yuv(__global uchar const * const rgb,
   const int yi_start = mad24(row,  WIDTH, col); // Start offset in the target yuv buffer
   int ui = mad24(row / 2, UV_WIDTH, RGB_SIZE + col / 2);
   int vi = mad24(row / 2 , UV_WIDTH, RGB_SIZE + UV_WIDTH * UV_HEIGHT + col / 2);
+  const int nv12_yi = mad24(row, NV12_STRIDE, col);
+  const int nv12_uvi = mad24(row / 2, NV12_STRIDE, NV12_UV_OFFSET + col);
   int num_col = min(WIDTH - col, 4);
   int num_row = min(HEIGHT - row, 4);
   if(num_row == 4) {
@@ -95,19 +117,19 @@ __kernel void rgb_to_yuv(__global uchar const * const rgb,
     const uchar8 rgbs3_0 = vload8(0, rgb + bgri_start + RGB_STRIDE * 3);
     const uchar8 rgbs3_1 = vload8(0, rgb + bgri_start + RGB_STRIDE * 3 + 8);
     if(num_col == 4) {
-      convert_4_ys(out_yuv, yi_start, rgbs0_0, rgbs0_1);
-      convert_4_ys(out_yuv, yi_start + WIDTH, rgbs1_0, rgbs1_1);
-      convert_4_ys(out_yuv, yi_start + WIDTH * 2, rgbs2_0, rgbs2_1);
-      convert_4_ys(out_yuv, yi_start + WIDTH * 3, rgbs3_0, rgbs3_1);
-      convert_2_uvs(out_yuv, ui, vi, rgbs0_0, rgbs1_0, rgbs0_1, rgbs1_1);
-      convert_2_uvs(out_yuv, ui + UV_WIDTH, vi + UV_WIDTH, rgbs2_0, rgbs3_0, rgbs2_1, rgbs3_1);
+      convert_4_ys(out_yuv, yi_start, out_nv12, nv12_yi, rgbs0_0, rgbs0_1);
+      convert_4_ys(out_yuv, yi_start + WIDTH, out_nv12, nv12_yi + NV12_STRIDE, rgbs1_0, rgbs1_1);
+      convert_4_ys(out_yuv, yi_start + WIDTH * 2, out_nv12, nv12_yi + NV12_STRIDE * 2, rgbs2_0, rgbs2_1);
+      convert_4_ys(out_yuv, yi_start + WIDTH * 3, out_nv12, nv12_yi + NV12_STRIDE * 3, rgbs3_0, rgbs3_1);
+      convert_2_uvs(out_yuv, ui, vi, out_nv12, nv12_uvi, rgbs0_0, rgbs1_0, rgbs0_1, rgbs1_1);
+      convert_2_uvs(out_yuv, ui + UV_WIDTH, vi + UV_WIDTH, out_nv12, nv12_uvi + NV12_STRIDE, rgbs2_0, rgbs3_0, rgbs2_1, rgbs3_1);
     } else if(num_col == 2) {
-      convert_2_ys(out_yuv, yi_start, rgbs0_0);
-      convert_2_ys(out_yuv, yi_start + WIDTH, rgbs1_0);
-      convert_2_ys(out_yuv, yi_start + WIDTH * 2, rgbs2_0);
-      convert_2_ys(out_yuv, yi_start + WIDTH * 3, rgbs3_0);
-      convert_uv(out_yuv, ui, vi, rgbs0_0, rgbs1_0);
-      convert_uv(out_yuv, ui + UV_WIDTH, vi + UV_WIDTH, rgbs2_0, rgbs3_0);
+      convert_2_ys(out_yuv, yi_start, out_nv12, nv12_yi, rgbs0_0);
+      convert_2_ys(out_yuv, yi_start + WIDTH, out_nv12, nv12_yi + NV12_STRIDE, rgbs1_0);
+      convert_2_ys(out_yuv, yi_start + WIDTH * 2, out_nv12, nv12_yi + NV12_STRIDE * 2, rgbs2_0);
+      convert_2_ys(out_yuv, yi_start + WIDTH * 3, out_nv12, nv12_yi + NV12_STRIDE * 3, rgbs3_0);
+      convert_uv(out_yuv, ui, vi, out_nv12, nv12_uvi, rgbs0_0, rgbs1_0);
+      convert_uv(out_yuv, ui + UV_WIDTH, vi + UV_WIDTH, out_nv12, nv12_uvi + NV12_STRIDE, rgbs2_0, rgbs3_0);
     }
   } else {
     const uchar8 rgbs0_0 = vload8(0, rgb + bgri_start);
@@ -115,13 +137,13 @@ __kernel void rgb_to_yuv(__global uchar const * const rgb,
     const uchar8 rgbs1_0 = vload8(0, rgb + bgri_start + RGB_STRIDE);
     const uchar8 rgbs1_1 = vload8(0, rgb + bgri_start + RGB_STRIDE + 8);
     if(num_col == 4) {
-      convert_4_ys(out_yuv, yi_start, rgbs0_0, rgbs0_1);
-      convert_4_ys(out_yuv, yi_start + WIDTH, rgbs1_0, rgbs1_1);
-      convert_2_uvs(out_yuv, ui, vi, rgbs0_0, rgbs1_0, rgbs0_1, rgbs1_1);
+      convert_4_ys(out_yuv, yi_start, out_nv12, nv12_yi, rgbs0_0, rgbs0_1);
+      convert_4_ys(out_yuv, yi_start + WIDTH, out_nv12, nv12_yi + NV12_STRIDE, rgbs1_0, rgbs1_1);
+      convert_2_uvs(out_yuv, ui, vi, out_nv12, nv12_uvi, rgbs0_0, rgbs1_0, rgbs0_1, rgbs1_1);
     } else if(num_col == 2) {
-      convert_2_ys(out_yuv, yi_start, rgbs0_0);
-      convert_2_ys(out_yuv, yi_start + WIDTH, rgbs1_0);
-      convert_uv(out_yuv, ui, vi, rgbs0_0, rgbs1_0);
+      convert_2_ys(out_yuv, yi_start, out_nv12, nv12_yi, rgbs0_0);
+      convert_2_ys(out_yuv, yi_start + WIDTH, out_nv12, nv12_yi + NV12_STRIDE, rgbs1_0);
+      convert_uv(out_yuv, ui, vi, out_nv12, nv12_uvi, rgbs0_0, rgbs1_0);
     }
   }
 }
@@ -4,9 +4,10 @@
 
 class Rgb2Yuv {
 public:
-  Rgb2Yuv(cl_context ctx, cl_device_id device_id, int width, int height, int rgb_stride);
+  // With an nv12_stride the kernel writes NV12 along with the I420 frame
+  Rgb2Yuv(cl_context ctx, cl_device_id device_id, int width, int height, int rgb_stride, int nv12_stride = 0, int nv12_uv_offset = 0);
   ~Rgb2Yuv();
-  void queue(cl_command_queue q, cl_mem rgb_cl, cl_mem yuv_cl);
+  void queue(cl_command_queue q, cl_mem rgb_cl, cl_mem yuv_cl, cl_mem nv12_cl = nullptr);
 private:
   size_t work_size[2];
   cl_kernel krnl;
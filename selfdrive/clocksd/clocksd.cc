@@ -77,7 +77,7 @@ int main() {
     clocks.setModemUptimeMillis(modem_uptime_v);
 #endif
 
-    pm.send("clocks", msg);
+    pm.send(ServiceId::clocks, msg);
   }
 
 #ifndef __APPLE__
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+
+// Latency histogram with log spaced buckets from 0.1 ms to a few seconds
+class LatencyHistogram {
+public:
+  static constexpr int NUM_BUCKETS = 32;
+
+  static float bucket_bound_ms(int i) { return 0.1f * std::pow(2.0f, i / 2.0f); }
+
+  void add(uint64_t ns) {
+    float ms = ns / 1e6;
+    int i = 0;
+    while (i < NUM_BUCKETS - 1 && ms > bucket_bound_ms(i)) i++;
+    counts_[i]++;
+    count_++;
+    sum_ms_ += ms;
+    max_ms_ = std::max(max_ms_, ms);
+  }
+
+  // Upper bound of the bucket that holds the p-th percentile
+  float percentile_ms(float p) const {
+    uint32_t target = std::ceil(p * count_), seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      seen += counts_[i];
+      if (seen >= target && seen > 0) return std::min(bucket_bound_ms(i), max_ms_);
+    }
+    return max_ms_;
+  }
+
+  void fill(cereal::LatencyStats::Stage::Builder stage) const {
+    stage.setCount(count_);
+    stage.setMeanMs(count_ > 0 ? sum_ms_ / count_ : 0);
+    stage.setMaxMs(max_ms_);
+    stage.setP50Ms(percentile_ms(0.5));
+    stage.setP90Ms(percentile_ms(0.9));
+    stage.setP99Ms(percentile_ms(0.99));
+
+    auto bounds = stage.initBucketBoundsMs(NUM_BUCKETS);
+    auto counts = stage.initBucketCounts(NUM_BUCKETS);
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      bounds.set(i, bucket_bound_ms(i));
+      counts.set(i, counts_[i]);
+    }
+  }
+
+  void reset() { *this = LatencyHistogram(); }
+
+private:
+  std::array<uint32_t, NUM_BUCKETS> counts_ = {};
+  uint32_t count_ = 0;
+  double sum_ms_ = 0;
+  float max_ms_ = 0;
+};
+
+// Named pipeline stages of one process, published to latencyStats and reset every interval
+class LatencyStages {
+public:
+  LatencyStages(const std::string &source, const std::vector<std::string> &names) : source_(source), names_(names), stages_(names.size()) {}
+
+  void add(size_t stage, uint64_t start_ns, uint64_t end_ns) {
+    if (end_ns >= start_ns) stages_[stage].add(end_ns - start_ns);
+  }
+
+  void publish(PubMaster &pm) {
+    MessageBuilder msg;
+    auto stats = msg.initEvent().initLatencyStats();
+    stats.setSource(source_);
+    auto stages = stats.initStages(stages_.size());
+    for (size_t i = 0; i < stages_.size(); i++) {
+      stages[i].setName(names_[i]);
+      stages_[i].fill(stages[i]);
+      stages_[i].reset();
+    }
+    pm.send(ServiceId::latencyStats, msg);
+  }
+
+  const std::string &name(size_t stage) const { return names_[stage]; }
+
+private:
+  std::string source_;
+  std::vector<std::string> names_;
+  std::vector<LatencyHistogram> stages_;
+};
@@ -42,6 +42,37 @@ const mat3 ecam_intrinsic_matrix =
                                0., 0., 0.,
                                0., 0., 0.}};
 
+// Part of the driver camera frame the driver monitoring model looks at. It's mirrored for RHD
+// so the driver is always on the same side
+struct DMonitoringCrop {
+  int x, y, w, h;
+  bool mirror;
+};
+
+static inline DMonitoringCrop get_dmonitoring_crop(int width, int height, bool is_rhd) {
+  DMonitoringCrop crop;
+  if (Hardware::TICI()) {
+    const int full_width_tici = 1928;
+    const int full_height_tici = 1208;
+    const int adapt_width_tici = 668;
+    const int cropped_height = adapt_width_tici / 1.33;
+    crop = {full_width_tici / 2 - adapt_width_tici / 2,
+            full_height_tici / 2 - cropped_height / 2 - 196,
+            cropped_height / 2,
+            cropped_height};
+    if (!is_rhd) {
+      crop.x += adapt_width_tici - crop.w + 32;
+    }
+  } else {
+    crop = {0, 0, height / 2, height};
+    if (!is_rhd) {
+      crop.x += width - crop.w;
+    }
+  }
+  crop.mirror = is_rhd;
+  return crop;
+}
+
 static inline mat3 get_model_yuv_transform(bool bayer = true) {
   float db_s = Hardware::TICI() ? 1.0 : 0.5; // debayering does a 2x downscale on EON
   const mat3 transform = (mat3){{
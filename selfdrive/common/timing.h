@@ -3,28 +3,52 @@
 #include <cstdint>
 #include <ctime>
 
+#include "cereal/messaging/sim_clock.h"
+
 #ifdef __APPLE__
 #define CLOCK_BOOTTIME CLOCK_MONOTONIC
 #endif
 
+// The time since boot follows the simulated clock when SIM_CLOCK=1, wall times never do
+
 static inline uint64_t nanos_since_boot() {
+  if (sim_clock_t *c = sim_clock()) return c->nanos;
+
   struct timespec t;
   clock_gettime(CLOCK_BOOTTIME, &t);
   return t.tv_sec * 1000000000ULL + t.tv_nsec;
 }
 
 static inline double millis_since_boot() {
+  if (sim_clock_t *c = sim_clock()) return c->nanos * 1e-6;
+
   struct timespec t;
   clock_gettime(CLOCK_BOOTTIME, &t);
   return t.tv_sec * 1000.0 + t.tv_nsec * 1e-6;
 }
 
 static inline double seconds_since_boot() {
+  if (sim_clock_t *c = sim_clock()) return c->nanos * 1e-9;
+
   struct timespec t;
   clock_gettime(CLOCK_BOOTTIME, &t);
   return (double)t.tv_sec + t.tv_nsec * 1e-9;
 }
 
+// Sleeps until nanos_since_boot() reaches t
+static inline void sleep_until_nanos(uint64_t t) {
+  if (sim_clock_t *c = sim_clock()) {
+    sim_clock_wait_until(c, t);
+    return;
+  }
+
+  uint64_t now = nanos_since_boot();
+  if (t > now) {
+    struct timespec ts = {(time_t)((t - now) / 1000000000ULL), (long)((t - now) % 1000000000ULL)};
+    nanosleep(&ts, NULL);
+  }
+}
+
 static inline uint64_t nanos_since_epoch() {
   struct timespec t;
   clock_gettime(CLOCK_REALTIME, &t);
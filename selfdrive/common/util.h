@@ -13,6 +13,8 @@
 #include <string>
 #include <thread>
 
+#include "cereal/messaging/sim_clock.h"
+
 #ifndef sighandler_t
 typedef void (*sighandler_t)(int sig);
 #endif
@@ -45,6 +47,10 @@ inline bool starts_with(const std::string& s, const std::string& prefix) {
   return s.compare(0, prefix.size(), prefix) == 0;
 }
 
+inline bool ends_with(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 template <typename... Args>
 std::string string_format(const std::string& format, Args... args) {
   size_t size = snprintf(nullptr, 0, format.c_str(), args...) + 1;
@@ -68,6 +74,10 @@ std::string readlink(const std::string& path);
 bool file_exists(const std::string& fn);
 
 inline void sleep_for(const int milliseconds) {
+  if (sim_clock_t *c = sim_clock()) {
+    sim_clock_wait_until(c, c->nanos + milliseconds * 1000000ULL);
+    return;
+  }
   std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
 }
 
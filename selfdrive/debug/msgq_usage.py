@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# type: ignore
+
+import argparse
+from collections import defaultdict, deque
+
+import cereal.messaging as messaging
+from cereal.services import service_list, get_buffer_size, BUFFER_RETENTION
+from common.realtime import sec_since_boot
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Measure msgq buffer usage to tune the sizes in services.py")
+  parser.add_argument("socket", type=str, nargs='*', help="socket name, defaults to all services")
+  parser.add_argument("--duration", type=float, default=60., help="seconds to measure for")
+  args = parser.parse_args()
+
+  socket_names = args.socket if len(args.socket) else list(service_list.keys())
+
+  poller = messaging.Poller()
+  sockets = {}
+  for name in socket_names:
+    sockets[messaging.sub_sock(name, poller=poller)] = name
+
+  counts = defaultdict(int)
+  max_sizes = defaultdict(int)
+  window = defaultdict(deque)
+  window_bytes = defaultdict(int)
+  high_water = defaultdict(int)
+
+  start = sec_since_boot()
+  t = start
+  while t - start < args.duration:
+    for sock in poller.poll(100):
+      t = sec_since_boot()
+      name = sockets[sock]
+
+      for dat in messaging.drain_sock_raw(sock):
+        size = len(dat) + 8  # size tag
+        counts[name] += 1
+        max_sizes[name] = max(max_sizes[name], len(dat))
+
+        # Bytes written over the last BUFFER_RETENTION seconds
+        window[name].append((t, size))
+        window_bytes[name] += size
+        while window[name][0][0] < t - BUFFER_RETENTION:
+          window_bytes[name] -= window[name].popleft()[1]
+        high_water[name] = max(high_water[name], window_bytes[name])
+
+    t = sec_since_boot()
+
+  duration = t - start
+  print(f"{'service':<24}{'msgs':>8}{'freq':>8}{'max size':>12}{'high water':>14}{'suggested':>14}{'configured':>14}")
+  for name in socket_names:
+    freq = counts[name] / duration
+    suggested = get_buffer_size(freq, max_sizes[name], max(max_sizes[name], service_list[name].max_msg_size))
+    configured = service_list[name].buffer_size
+    flag = " <-- too small" if high_water[name] > configured else ""
+    if max_sizes[name] > service_list[name].max_msg_size:
+      flag += " <-- message larger than max_msg_size"
+    print(f"{name:<24}{counts[name]:>8}{freq:>8.1f}{max_sizes[name]:>12}{high_water[name]:>14}{suggested:>14}{configured:>14}{flag}")
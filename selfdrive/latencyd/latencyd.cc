@@ -0,0 +1,193 @@
+// Follows every road camera frame through modeld, plannerd and controlsd using the
+// monotonic timestamps each stage copies from its input, and publishes per-stage latency
+// histograms on latencyStats once a second.
+// Usage: latencyd [--trace path]
+//
+// With --trace the spans of every frame are also written as Chrome trace JSON on exit,
+// open it in chrome://tracing or ui.perfetto.dev.
+
+#include <cassert>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/latency.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+ExitHandler do_exit;
+
+const size_t MAX_FRAMES = 100;
+const size_t MAX_TRACE_SPANS = 1000000;
+const uint64_t SENDCAN_MAX_DELAY_NS = 10 * 1e6;
+
+enum Stage {
+  CAMERA_TO_MODEL,
+  MODEL_TO_LATERAL_PLAN,
+  LATERAL_PLAN_TO_CONTROLS,
+  LATERAL_PLAN_TO_SENDCAN,
+  CAMERA_TO_SENDCAN,
+};
+
+struct Frame {
+  uint64_t mono_time;  // logMonoTime of the message
+  uint64_t eof;        // end of frame of the camera frame it was computed from
+  uint32_t frame_id;
+};
+
+struct Span {
+  Stage stage;
+  uint64_t start, end;
+  uint32_t frame_id;
+};
+
+class LatencyTracer {
+public:
+  LatencyTracer(bool trace) : trace_(trace),
+    stages_("latencyd", {"camera->modelV2", "modelV2->lateralPlan", "lateralPlan->controlsState",
+                         "lateralPlan->sendcan", "camera->sendcan"}) {}
+
+  void modelV2(uint64_t mono_time, cereal::ModelDataV2::Reader model) {
+    push(models_, {mono_time, model.getTimestampEof(), model.getFrameId()});
+    add(CAMERA_TO_MODEL, model.getTimestampEof(), mono_time, model.getFrameId());
+  }
+
+  void lateralPlan(uint64_t mono_time, cereal::LateralPlan::Reader plan) {
+    if (const Frame *model = find(models_, plan.getModelMonoTime())) {
+      push(plans_, {mono_time, model->eof, model->frame_id});
+      add(MODEL_TO_LATERAL_PLAN, model->mono_time, mono_time, model->frame_id);
+    }
+  }
+
+  void sendcan(uint64_t mono_time) { last_sendcan_ = mono_time; }
+
+  // controlsd sends sendcan right before controlsState, both computed from the same lateralPlan
+  void controlsState(uint64_t mono_time, cereal::ControlsState::Reader cs) {
+    const Frame *plan = find(plans_, cs.getLateralPlanMonoTime());
+    if (plan == nullptr) return;
+
+    add(LATERAL_PLAN_TO_CONTROLS, plan->mono_time, mono_time, plan->frame_id);
+    if (last_sendcan_ <= mono_time && mono_time - last_sendcan_ < SENDCAN_MAX_DELAY_NS) {
+      add(LATERAL_PLAN_TO_SENDCAN, plan->mono_time, last_sendcan_, plan->frame_id);
+      add(CAMERA_TO_SENDCAN, plan->eof, last_sendcan_, plan->frame_id);
+    }
+  }
+
+  void publish(PubMaster &pm) { stages_.publish(pm); }
+
+  void write_trace(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == nullptr) {
+      LOGE("failed to write trace to %s", path.c_str());
+      return;
+    }
+
+    fprintf(f, "{\"traceEvents\": [\n");
+    for (int i = 0; i <= CAMERA_TO_SENDCAN; i++) {
+      fprintf(f, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+              i, stages_.name(i).c_str());
+    }
+    for (size_t i = 0; i < spans_.size(); i++) {
+      const Span &s = spans_[i];
+      fprintf(f, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frameId\": %u}}%s\n",
+              stages_.name(s.stage).c_str(), s.stage, s.start / 1e3, (s.end - s.start) / 1e3, s.frame_id,
+              i + 1 < spans_.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    LOGW("wrote %zu spans to %s", spans_.size(), path.c_str());
+  }
+
+private:
+  void add(Stage stage, uint64_t start, uint64_t end, uint32_t frame_id) {
+    stages_.add(stage, start, end);
+    if (trace_ && end >= start && spans_.size() < MAX_TRACE_SPANS) {
+      spans_.push_back({stage, start, end, frame_id});
+    }
+  }
+
+  static void push(std::deque<Frame> &frames, const Frame &frame) {
+    frames.push_back(frame);
+    if (frames.size() > MAX_FRAMES) frames.pop_front();
+  }
+
+  static const Frame *find(const std::deque<Frame> &frames, uint64_t mono_time) {
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+      if (it->mono_time == mono_time) return &*it;
+    }
+    return nullptr;
+  }
+
+  bool trace_;
+  LatencyStages stages_;
+  std::deque<Frame> models_, plans_;
+  std::vector<Span> spans_;
+  uint64_t last_sendcan_ = 0;
+};
+
+int main(int argc, char *argv[]) {
+  std::string trace_path;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--trace" && i + 1 < argc) {
+      trace_path = argv[++i];
+    }
+  }
+
+  LatencyTracer tracer(!trace_path.empty());
+  PubMaster pm({"latencyStats"});
+
+  // sendcan is registered before controlsState, so a sendcan that's ready is handled first
+  std::unique_ptr<Context> context(Context::create());
+  std::unique_ptr<Poller> poller(Poller::create());
+  std::map<SubSocket *, std::string> sockets;
+  for (const char *name : {"modelV2", "lateralPlan", "sendcan", "controlsState"}) {
+    SubSocket *sock = SubSocket::create(context.get(), name);
+    assert(sock != NULL);
+    poller->registerSocket(sock);
+    sockets[sock] = name;
+  }
+
+  AlignedBuffer aligned_buf;
+  std::vector<SubSocket *> ready;
+  uint64_t last_publish = nanos_since_boot();
+  while (!do_exit) {
+    poller->poll(100, ready);
+    for (SubSocket *sock : ready) {
+      const std::string &name = sockets[sock];
+      while (true) {
+        std::unique_ptr<Message> msg(sock->receive(true));
+        if (!msg) break;
+
+        capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
+        cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+        if (name == "modelV2") {
+          tracer.modelV2(event.getLogMonoTime(), event.getModelV2());
+        } else if (name == "lateralPlan") {
+          tracer.lateralPlan(event.getLogMonoTime(), event.getLateralPlan());
+        } else if (name == "sendcan") {
+          tracer.sendcan(event.getLogMonoTime());
+        } else {
+          tracer.controlsState(event.getLogMonoTime(), event.getControlsState());
+        }
+      }
+    }
+
+    uint64_t t = nanos_since_boot();
+    if (t - last_publish >= 1e9) {
+      tracer.publish(pm);
+      last_publish = t;
+    }
+  }
+
+  if (!trace_path.empty()) {
+    tracer.write_trace(trace_path);
+  }
+
+  for (auto &[sock, name] : sockets) delete sock;
+  return 0;
+}
@@ -444,15 +444,15 @@ int Localizer::locationd_thread() {
       }
     }
 
-    if (sm.updated("cameraOdometry")) {
-      uint64_t logMonoTime = sm["cameraOdometry"].getLogMonoTime();
+    if (sm.updated(ServiceId::cameraOdometry)) {
+      uint64_t logMonoTime = sm[ServiceId::cameraOdometry].getLogMonoTime();
       bool inputsOK = sm.allAliveAndValid();
-      bool sensorsOK = sm.alive("sensorEvents") && sm.valid("sensorEvents");
+      bool sensorsOK = sm.alive(ServiceId::sensorEvents) && sm.valid(ServiceId::sensorEvents);
       bool gpsOK = (logMonoTime / 1e9) - this->last_gps_fix < 1.0;
 
       MessageBuilder msg_builder;
       kj::ArrayPtr<capnp::byte> bytes = this->get_message_bytes(msg_builder, logMonoTime, inputsOK, sensorsOK, gpsOK);
-      pm.send("liveLocationKalman", bytes.begin(), bytes.size());
+      pm.send(ServiceId::liveLocationKalman, bytes.begin(), bytes.size());
 
       if (sm.frame % 1200 == 0 && gpsOK) {  // once a minute
         VectorXd posGeo = this->get_position_geodetic();
@@ -56,7 +56,7 @@ int main() {
       androidEntry.setTag(entry.tag);
       androidEntry.setMessage(entry.message);
 
-      pm.send("androidLog", msg);
+      pm.send(ServiceId::androidLog, msg);
     }
 
     android_logger_list_free(logger_list);
@@ -63,7 +63,7 @@ int main(int argc, char *argv[]) {
     if (kv.count("PRIORITY")) androidEntry.setPriority(std::atoi(kv["PRIORITY"].c_str()));
     if (kv.count("SYSLOG_IDENTIFIER")) androidEntry.setTag(kv["SYSLOG_IDENTIFIER"]);
 
-    pm.send("androidLog", msg);
+    pm.send(ServiceId::androidLog, msg);
   }
 
   sd_journal_close(journal);
@@ -32,9 +32,12 @@
 #if defined(QCOM) || defined(QCOM2)
 #include "selfdrive/loggerd/omx_encoder.h"
 #define Encoder OmxEncoder
+// camerad sends NV12 in the layout of the hardware encoder
+#define ENCODER_STREAM(cam) VISION_STREAM_NV12_##cam
 #else
 #include "selfdrive/loggerd/raw_logger.h"
 #define Encoder RawLogger
+#define ENCODER_STREAM(cam) VISION_STREAM_YUV_##cam
 #endif
 
 namespace {
@@ -52,7 +55,7 @@ ExitHandler do_exit;
 
 LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
   [LOG_CAMERA_ID_FCAMERA] = {
-    .stream_type = VISION_STREAM_YUV_BACK,
+    .stream_type = ENCODER_STREAM(BACK),
     .filename = "fcamera.hevc",
     .frame_packet_name = "roadCameraState",
     .fps = MAIN_FPS,
@@ -62,7 +65,7 @@ LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
     .has_qcamera = true
   },
   [LOG_CAMERA_ID_DCAMERA] = {
-    .stream_type = VISION_STREAM_YUV_FRONT,
+    .stream_type = ENCODER_STREAM(FRONT),
     .filename = "dcamera.hevc",
     .frame_packet_name = "driverCameraState",
     .fps = MAIN_FPS, // on EONs, more compressed this way
@@ -72,7 +75,7 @@ LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
     .has_qcamera = false
   },
   [LOG_CAMERA_ID_ECAMERA] = {
-    .stream_type = VISION_STREAM_YUV_WIDE,
+    .stream_type = ENCODER_STREAM(WIDE),
     .filename = "ecamera.hevc",
     .frame_packet_name = "wideRoadCameraState",
     .fps = MAIN_FPS,
@@ -256,8 +259,7 @@ void encoder_thread(int cam_idx) {
 
       // encode a frame
       for (int i = 0; i < encoders.size(); ++i) {
-        int out_id = encoders[i]->encode_frame(buf->y, buf->u, buf->v,
-                                               buf->width, buf->height, extra.timestamp_eof);
+        int out_id = encoders[i]->encode_frame(buf, extra.timestamp_eof);
         if (i == 0 && out_id != -1) {
           // publish encode index
           MessageBuilder msg;
@@ -370,7 +372,7 @@ int main(int argc, char** argv) {
 
   uint64_t msg_count = 0;
   uint64_t bytes_count = 0;
-  AlignedBuffer aligned_buf;
+  MessageBatch batch;
 
   double start_ts = seconds_since_boot();
   double last_rotate_tms = millis_since_boot();
@@ -380,41 +382,34 @@ int main(int argc, char** argv) {
     // poll for new messages on all sockets
     for (auto sock : poller->poll(1000)) {
 
-      // drain socket
-      Message * last_msg = nullptr;
-      while (!do_exit) {
-        Message * msg = sock->receive(true);
-        if (!msg) {
+      int fpkt_id = -1;
+      for (int cid = 0; cid <=MAX_CAM_IDX; cid++) {
+        if (sock == s.rotate_state[cid].fpkt_sock) {
+          fpkt_id=cid;
           break;
         }
-        delete last_msg;
-        last_msg = msg;
+      }
 
+      // drain socket
+      while (!do_exit && sock->receive_batch(batch, 1000, 10 * 1024 * 1024) > 0) {
         QlogState& qs = qlog_states[sock];
-        logger_log(&s.logger, (uint8_t*)msg->getData(), msg->getSize(), qs.counter == 0 && qs.freq != -1);
-        if (qs.freq != -1) {
-          qs.counter = (qs.counter + 1) % qs.freq;
-        }
-
-        bytes_count += msg->getSize();
-        if ((++msg_count % 1000) == 0) {
-          double ts = seconds_since_boot();
-          LOGD("%lu messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count * 1.0 / (ts - start_ts), bytes_count * 0.001 / (ts - start_ts));
-        }
-      }
+        for (size_t i = 0; i < batch.size(); i++) {
+          logger_log(&s.logger, (uint8_t*)batch.getData(i), batch.getSize(i), qs.counter == 0 && qs.freq != -1);
+          if (qs.freq != -1) {
+            qs.counter = (qs.counter + 1) % qs.freq;
+          }
 
-      if (last_msg) {
-        int fpkt_id = -1;
-        for (int cid = 0; cid <=MAX_CAM_IDX; cid++) {
-          if (sock == s.rotate_state[cid].fpkt_sock) {
-            fpkt_id=cid;
-            break;
+          bytes_count += batch.getSize(i);
+          if ((++msg_count % 1000) == 0) {
+            double ts = seconds_since_boot();
+            LOGD("%lu messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count * 1.0 / (ts - start_ts), bytes_count * 0.001 / (ts - start_ts));
           }
         }
+
         if (fpkt_id >= 0) {
           // track camera frames to sync to encoder
           // only process last frame
-          capnp::FlatArrayMessageReader cmsg(aligned_buf.align(last_msg));
+          capnp::FlatArrayMessageReader cmsg(batch.getWords(batch.size() - 1));
           cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
 
           if (fpkt_id == LOG_CAMERA_ID_FCAMERA) {
@@ -427,7 +422,6 @@ int main(int argc, char** argv) {
           last_camera_seen_tms = millis_since_boot();
         }
       }
-      delete last_msg;
     }
 
     bool new_segment = s.logger.part == -1;
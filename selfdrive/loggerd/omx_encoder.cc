@@ -9,6 +9,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 
 #include <OMX_Component.h>
 #include <OMX_IndexExt.h>
@@ -394,8 +395,7 @@ void OmxEncoder::handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf) {
   OMX_CHECK(OMX_FillThisBuffer(e->handle, out_buf));
 }
 
-int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
-                             int in_width, int in_height, uint64_t ts) {
+int OmxEncoder::encode_frame(const VisionBuf *buf, uint64_t ts) {
   int err;
   if (!this->is_open) {
     return -1;
@@ -424,27 +424,49 @@ int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const u
   // uint8_t *in_uv_ptr = in_buf_ptr + (this->width * this->height);
   uint8_t *in_uv_ptr = in_buf_ptr + (in_y_stride * VENUS_Y_SCANLINES(COLOR_FMT_NV12, this->height));
 
-  if (this->downscale) {
-    I420Scale(y_ptr, in_width,
-              u_ptr, in_width/2,
-              v_ptr, in_width/2,
-              in_width, in_height,
-              this->y_ptr2, this->width,
-              this->u_ptr2, this->width/2,
-              this->v_ptr2, this->width/2,
-              this->width, this->height,
-              libyuv::kFilterNone);
-    y_ptr = this->y_ptr2;
-    u_ptr = this->u_ptr2;
-    v_ptr = this->v_ptr2;
+  if (buf->nv12) {
+    if (this->downscale) {
+      libyuv::ScalePlane(buf->y, buf->stride, buf->width, buf->height,
+                         in_y_ptr, in_y_stride, this->width, this->height,
+                         libyuv::kFilterNone);
+      // without filtering an interleaved u and v pair can be scaled as one 16 bit pixel
+      libyuv::ScalePlane_16((const uint16_t *)buf->uv, buf->uv_stride / 2, buf->width / 2, buf->height / 2,
+                            (uint16_t *)in_uv_ptr, in_uv_stride / 2, this->width / 2, this->height / 2,
+                            libyuv::kFilterNone);
+    } else if ((int)buf->stride == in_y_stride && in_y_ptr + buf->uv_offset == in_uv_ptr) {
+      // camerad wrote it in the layout of the input buffers
+      memcpy(in_buf_ptr, buf->y, buf->uv_offset + buf->uv_stride * (this->height / 2));
+    } else {
+      libyuv::CopyPlane(buf->y, buf->stride, in_y_ptr, in_y_stride, this->width, this->height);
+      libyuv::CopyPlane(buf->uv, buf->uv_stride, in_uv_ptr, in_uv_stride, this->width, this->height / 2);
+    }
+  } else {
+    const uint8_t *y_ptr = buf->y, *u_ptr = buf->u, *v_ptr = buf->v;
+    int y_stride = buf->stride, uv_stride = buf->uv_stride;
+    if (this->downscale) {
+      I420Scale(y_ptr, y_stride,
+                u_ptr, uv_stride,
+                v_ptr, uv_stride,
+                buf->width, buf->height,
+                this->y_ptr2, this->width,
+                this->u_ptr2, this->width/2,
+                this->v_ptr2, this->width/2,
+                this->width, this->height,
+                libyuv::kFilterNone);
+      y_ptr = this->y_ptr2;
+      u_ptr = this->u_ptr2;
+      v_ptr = this->v_ptr2;
+      y_stride = this->width;
+      uv_stride = this->width/2;
+    }
+    err = libyuv::I420ToNV12(y_ptr, y_stride,
+                     u_ptr, uv_stride,
+                     v_ptr, uv_stride,
+                     in_y_ptr, in_y_stride,
+                     in_uv_ptr, in_uv_stride,
+                     this->width, this->height);
+    assert(err == 0);
   }
-  err = libyuv::I420ToNV12(y_ptr, this->width,
-                   u_ptr, this->width/2,
-                   v_ptr, this->width/2,
-                   in_y_ptr, in_y_stride,
-                   in_uv_ptr, in_uv_stride,
-                   this->width, this->height);
-  assert(err == 0);
 
   // in_buf->nFilledLen = (this->width*this->height) + (this->width*this->height/2);
   in_buf->nFilledLen = VENUS_BUFFER_SIZE(COLOR_FMT_NV12, this->width, this->height);
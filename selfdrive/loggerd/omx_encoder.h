@@ -17,8 +17,7 @@ class OmxEncoder : public VideoEncoder {
 public:
   OmxEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale);
   ~OmxEncoder();
-  int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
-                   int in_width, int in_height, uint64_t ts);
+  int encode_frame(const VisionBuf *buf, uint64_t ts);
   void encoder_open(const char* path);
   void encoder_close();
 
@@ -116,16 +116,19 @@ void RawLogger::encoder_close() {
   is_open = false;
 }
 
-int RawLogger::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
-                            int in_width, int in_height, uint64_t ts) {
+int RawLogger::encode_frame(const VisionBuf *buf, uint64_t ts) {
+  assert(!buf->nv12);
   AVPacket pkt;
   av_init_packet(&pkt);
   pkt.data = NULL;
   pkt.size = 0;
 
-  frame->data[0] = (uint8_t*)y_ptr;
-  frame->data[1] = (uint8_t*)u_ptr;
-  frame->data[2] = (uint8_t*)v_ptr;
+  frame->data[0] = buf->y;
+  frame->data[1] = buf->u;
+  frame->data[2] = buf->v;
+  frame->linesize[0] = buf->stride;
+  frame->linesize[1] = buf->uv_stride;
+  frame->linesize[2] = buf->uv_stride;
   frame->pts = ts;
 
   int ret = counter;
@@ -42,8 +42,8 @@ void calibration_thread(bool wide_camera) {
 
   while (!do_exit) {
     sm.update(100);
-    if(sm.updated("liveCalibration")) {
-      auto extrinsic_matrix = sm["liveCalibration"].getLiveCalibration().getExtrinsicMatrix();
+    if(sm.updated(ServiceId::liveCalibration)) {
+      auto extrinsic_matrix = sm[ServiceId::liveCalibration].getLiveCalibration().getExtrinsicMatrix();
       Eigen::Matrix<float, 3, 4> extrinsic_matrix_eigen;
       for (int i = 0; i < 4*3; i++) {
         extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
@@ -72,6 +72,8 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
   // messaging
   PubMaster pm({"modelV2", "cameraOdometry"});
   SubMaster sm({"lateralPlan", "roadCameraState"});
+  // modelV2 is the larger of the two, with room for the raw predictions
+  ReusableMessageBuilder builder(64 * 1024);
 
   // setup filter to track dropped frames
   FirstOrderFilter frame_dropped_filter(0., 10., 1. / MODEL_FREQ);
@@ -92,8 +94,8 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
 
     // TODO: path planner timeout?
     sm.update(0);
-    int desire = ((int)sm["lateralPlan"].getLateralPlan().getDesire());
-    frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
+    int desire = ((int)sm[ServiceId::lateralPlan].getLateralPlan().getDesire());
+    frame_id = sm[ServiceId::roadCameraState].getRoadCameraState().getFrameId();
 
     if (run_model_this_iter) {
       run_count++;
@@ -119,9 +121,9 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
 
       float frame_drop_ratio = frames_dropped / (1 + frames_dropped);
 
-      model_publish(pm, extra.frame_id, frame_id, frame_drop_ratio, model_buf, extra.timestamp_eof, model_execution_time,
+      model_publish(pm, builder.reset(), extra.frame_id, frame_id, frame_drop_ratio, model_buf, extra.timestamp_eof, model_execution_time,
                     kj::ArrayPtr<const float>(model.output.data(), model.output.size()));
-      posenet_publish(pm, extra.frame_id, vipc_dropped_frames, model_buf, extra.timestamp_eof);
+      posenet_publish(pm, builder.reset(), extra.frame_id, vipc_dropped_frames, model_buf, extra.timestamp_eof);
 
       //printf("model process: %.2fms, from last %.2fms, vipc_frame_id %u, frame_id, %u, frame_drop %.3f\n", mt2 - mt1, mt1 - last, extra.frame_id, frame_id, frame_drop_ratio);
       last = mt1;
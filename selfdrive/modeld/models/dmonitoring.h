@@ -29,11 +29,8 @@ typedef struct DMonitoringResult {
 
 typedef struct DMonitoringModelState {
   RunModel *m;
-  bool is_rhd;
   float output[OUTPUT_SIZE];
   std::vector<uint8_t> resized_buf;
-  std::vector<uint8_t> cropped_buf;
-  std::vector<uint8_t> premirror_cropped_buf;
   std::vector<float> net_input_buf;
 } DMonitoringModelState;
 
@@ -310,11 +310,10 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   }
 }
 
-void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
-                   const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
+void model_publish(PubMaster &pm, MessageBuilder &msg, uint32_t vipc_frame_id, uint32_t frame_id,
+                   float frame_drop, const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
                    float model_execution_time, kj::ArrayPtr<const float> raw_pred) {
   const uint32_t frame_age = (frame_id > vipc_frame_id) ? (frame_id - vipc_frame_id) : 0;
-  MessageBuilder msg;
   auto framed = msg.initEvent().initModelV2();
   framed.setFrameId(vipc_frame_id);
   framed.setFrameAge(frame_age);
@@ -325,11 +324,11 @@ void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, flo
     framed.setRawPredictions(raw_pred.asBytes());
   }
   fill_model(framed, net_outputs);
-  pm.send("modelV2", msg);
+  pm.send(ServiceId::modelV2, msg);
 }
 
-void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
-                     const ModelDataRaw &net_outputs, uint64_t timestamp_eof) {
+void posenet_publish(PubMaster &pm, MessageBuilder &msg, uint32_t vipc_frame_id,
+                     uint32_t vipc_dropped_frames, const ModelDataRaw &net_outputs, uint64_t timestamp_eof) {
   float trans_arr[3];
   float trans_std_arr[3];
   float rot_arr[3];
@@ -343,7 +342,6 @@ void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_droppe
     rot_std_arr[i] = exp(net_outputs.pose[9 + i]);
   }
 
-  MessageBuilder msg;
   auto posenetd = msg.initEvent(vipc_dropped_frames < 1).initCameraOdometry();
   posenetd.setTrans(trans_arr);
   posenetd.setRot(rot_arr);
@@ -353,5 +351,5 @@ void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_droppe
   posenetd.setTimestampEof(timestamp_eof);
   posenetd.setFrameId(vipc_frame_id);
 
-  pm.send("cameraOdometry", msg);
+  pm.send(ServiceId::cameraOdometry, msg);
 }
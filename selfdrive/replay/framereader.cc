@@ -0,0 +1,99 @@
+#include "selfdrive/replay/framereader.h"
+
+#include "selfdrive/common/swaglog.h"
+
+FrameReader::~FrameReader() {
+  close();
+}
+
+bool FrameReader::open(const std::string &file_path) {
+  close();
+  path = file_path;
+
+  av_register_all();
+  if (avformat_open_input(&fmt_ctx, path.c_str(), NULL, NULL) != 0) {
+    LOGE("failed to open %s", path.c_str());
+    return false;
+  }
+  if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+    LOGE("no stream info in %s", path.c_str());
+    close();
+    return false;
+  }
+
+  stream_idx = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if (stream_idx < 0) {
+    LOGE("no video stream in %s", path.c_str());
+    close();
+    return false;
+  }
+
+  AVCodecParameters *par = fmt_ctx->streams[stream_idx]->codecpar;
+  AVCodec *codec = avcodec_find_decoder(par->codec_id);
+  if (codec == nullptr) {
+    LOGE("no decoder for %s", path.c_str());
+    close();
+    return false;
+  }
+
+  codec_ctx = avcodec_alloc_context3(codec);
+  avcodec_parameters_to_context(codec_ctx, par);
+  codec_ctx->thread_count = 0;  // one per core
+  if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    LOGE("failed to open decoder for %s", path.c_str());
+    close();
+    return false;
+  }
+
+  frame = av_frame_alloc();
+  pkt = av_packet_alloc();
+  width = codec_ctx->width;
+  height = codec_ctx->height;
+  frame_idx = -1;
+  return true;
+}
+
+void FrameReader::close() {
+  av_packet_free(&pkt);
+  av_frame_free(&frame);
+  avcodec_free_context(&codec_ctx);
+  avformat_close_input(&fmt_ctx);
+  stream_idx = -1;
+}
+
+const AVFrame *FrameReader::get(int idx) {
+  if (codec_ctx == nullptr || idx < 0) return nullptr;
+
+  if (idx < frame_idx && !open(path)) return nullptr;
+
+  // Frames depend on the ones before them, so every frame up to idx has to be decoded
+  while (frame_idx < idx) {
+    if (!decode_next()) return nullptr;
+  }
+  return frame;
+}
+
+bool FrameReader::decode_next() {
+  while (true) {
+    int ret = avcodec_receive_frame(codec_ctx, frame);
+    if (ret == 0) {
+      frame_idx++;
+      return true;
+    } else if (ret != AVERROR(EAGAIN)) {
+      return false;  // end of file or error
+    }
+
+    if (av_read_frame(fmt_ctx, pkt) >= 0) {
+      ret = pkt->stream_index == stream_idx ? avcodec_send_packet(codec_ctx, pkt) : 0;
+      av_packet_unref(pkt);
+    } else {
+      // Flush the frames buffered in the decoder
+      ret = avcodec_send_packet(codec_ctx, NULL);
+    }
+
+    if (ret < 0 && ret != AVERROR_EOF) {
+      LOGE("failed to decode frame %d of %s", frame_idx + 1, path.c_str());
+      return false;
+    }
+  }
+}
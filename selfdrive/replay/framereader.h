@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Decodes a camera file like fcamera.hevc frame by frame
+class FrameReader {
+public:
+  FrameReader() = default;
+  FrameReader(const FrameReader &) = delete;
+  FrameReader &operator=(const FrameReader &) = delete;
+  ~FrameReader();
+
+  bool open(const std::string &path);
+
+  // Returns frame idx in YUV420, or nullptr if the file doesn't have it. The frame is valid
+  // until the next call. Reading backwards reopens the file, so read in increasing order.
+  const AVFrame *get(int idx);
+
+  int width = 0;
+  int height = 0;
+
+private:
+  bool decode_next();
+  void close();
+
+  std::string path;
+  AVFormatContext *fmt_ctx = nullptr;
+  AVCodecContext *codec_ctx = nullptr;
+  AVFrame *frame = nullptr;
+  AVPacket *pkt = nullptr;
+  int stream_idx = -1;
+  int frame_idx = -1;
+};
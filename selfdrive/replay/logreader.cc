@@ -0,0 +1,109 @@
+#include "selfdrive/replay/logreader.h"
+
+#include <bzlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+LogReader::~LogReader() {
+  if (mmap_addr != nullptr) {
+    munmap(mmap_addr, mmap_len);
+  }
+}
+
+bool LogReader::load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOGE("failed to open %s", path.c_str());
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOGE("failed to mmap %s", path.c_str());
+    return false;
+  }
+  mmap_addr = addr;
+  mmap_len = st.st_size;
+
+  kj::ArrayPtr<const capnp::word> words;
+  if (util::ends_with(path, ".bz2")) {
+    if (!decompress_bz2((const char *)addr, st.st_size)) {
+      LOGE("failed to decompress %s", path.c_str());
+      return false;
+    }
+    // The compressed log isn't needed anymore
+    munmap(mmap_addr, mmap_len);
+    mmap_addr = nullptr;
+    words = decompressed.slice(0, decompressed_words);
+  } else {
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    words = kj::ArrayPtr<const capnp::word>((const capnp::word *)addr, st.st_size / sizeof(capnp::word));
+  }
+
+  while (words.size() > 0) {
+    try {
+      capnp::FlatArrayMessageReader msg(words);
+      cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+      const capnp::word *end = msg.getEnd();
+      events.push_back({event.which(), event.getLogMonoTime(), kj::ArrayPtr<const capnp::word>(words.begin(), end)});
+      words = kj::ArrayPtr<const capnp::word>(end, words.end());
+    } catch (const kj::Exception &e) {
+      // The last event of a log from a crashed loggerd can be cut off
+      LOGW("failed to parse event %zu of %s: %s", events.size(), path.c_str(), e.getDescription().cStr());
+      break;
+    }
+  }
+
+  std::stable_sort(events.begin(), events.end(), [](const LogEvent &a, const LogEvent &b) {
+    return a.mono_time < b.mono_time;
+  });
+  return !events.empty();
+}
+
+bool LogReader::decompress_bz2(const char *data, size_t size) {
+  bz_stream strm = {};
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) return false;
+
+  // rlogs compress about 5x, grow from there
+  kj::Array<capnp::word> buf = kj::heapArray<capnp::word>(std::max<size_t>(size * 5 / sizeof(capnp::word), 1024));
+  strm.next_in = (char *)data;
+  strm.avail_in = size;
+  strm.next_out = (char *)buf.begin();
+  strm.avail_out = buf.size() * sizeof(capnp::word);
+
+  int ret = BZ_OK;
+  while (ret == BZ_OK) {
+    if (strm.avail_out == 0) {
+      // capnp::word can't be copied, grow by hand
+      size_t used = buf.size();
+      kj::Array<capnp::word> grown = kj::heapArray<capnp::word>(used * 2);
+      memcpy((char *)grown.begin(), (char *)buf.begin(), used * sizeof(capnp::word));
+      buf = kj::mv(grown);
+      strm.next_out = (char *)(buf.begin() + used);
+      strm.avail_out = used * sizeof(capnp::word);
+    }
+    ret = BZ2_bzDecompress(&strm);
+    // A log from a crashed loggerd ends without the end of stream marker
+    if (ret == BZ_OK && strm.avail_in == 0 && strm.avail_out > 0) break;
+  }
+
+  size_t total = ((uint64_t)strm.total_out_hi32 << 32) | strm.total_out_lo32;
+  BZ2_bzDecompressEnd(&strm);
+  decompressed = kj::mv(buf);
+  decompressed_words = total / sizeof(capnp::word);
+  return ret == BZ_OK || ret == BZ_STREAM_END;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <capnp/serialize.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+struct LogEvent {
+  cereal::Event::Which which;
+  uint64_t mono_time;
+  kj::ArrayPtr<const capnp::word> words;
+};
+
+// Memory maps an rlog and indexes its events, logs compressed with bz2 are decompressed
+// into memory instead. The events point into the log and are valid as long as the reader.
+class LogReader {
+public:
+  LogReader() = default;
+  LogReader(const LogReader &) = delete;
+  LogReader &operator=(const LogReader &) = delete;
+  ~LogReader();
+
+  bool load(const std::string &path);
+
+  // Sorted by mono_time
+  std::vector<LogEvent> events;
+
+private:
+  bool decompress_bz2(const char *data, size_t size);
+
+  void *mmap_addr = nullptr;
+  size_t mmap_len = 0;
+  kj::Array<capnp::word> decompressed;
+  size_t decompressed_words = 0;
+};
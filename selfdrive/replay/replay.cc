@@ -0,0 +1,298 @@
+// Plays recorded segments back into msgq and VisionIPC, to run modeld, locationd or controlsd
+// offline against a real drive. Events are published on their original services with their
+// original relative timing scaled by --speed, and the road camera frames of fcamera.hevc are
+// sent on camerad's streams when their roadCameraState is published.
+//
+// Usage: replay [--speed x] [--allow service,...] [--block service,...] [--no-vipc] <segment dir> ...
+//
+// --speed 0 replays as fast as the consumers allow: before every message it waits until the
+// subscribers of that service have read the previous one. Block the services of the processes
+// under test, e.g. run modeld with --block modelV2,cameraOdometry.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "libyuv.h"
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+#include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/replay/framereader.h"
+#include "selfdrive/replay/logreader.h"
+
+ExitHandler do_exit;
+
+const int RGB_BUF_COUNT = 4;
+const int YUV_BUF_COUNT = 20;
+const uint64_t MAX_SUBSCRIBER_WAIT_NS = 100 * 1e6;
+
+struct Segment {
+  std::string path;
+  LogReader log;
+  FrameReader frames;
+  bool has_frames = false;
+  std::unordered_map<uint32_t, uint32_t> frame_idx;  // frameId -> index in fcamera.hevc
+};
+
+struct Publisher {
+  std::string name;
+  std::unique_ptr<PubSocket> sock;
+  bool wait_for_subscribers = true;
+};
+
+static std::set<std::string> split(const std::string &str) {
+  std::set<std::string> items;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) items.insert(item);
+  }
+  return items;
+}
+
+static std::unique_ptr<Segment> load_segment(const std::string &path, bool load_frames) {
+  auto seg = std::make_unique<Segment>();
+  seg->path = path;
+
+  std::string rlog = path + "/rlog";
+  if (!util::file_exists(rlog)) rlog += ".bz2";
+  if (!seg->log.load(rlog)) {
+    LOGE("no events in %s", rlog.c_str());
+    return nullptr;
+  }
+
+  if (load_frames) {
+    seg->has_frames = seg->frames.open(path + "/fcamera.hevc");
+    for (const LogEvent &e : seg->log.events) {
+      if (e.which != cereal::Event::ROAD_ENCODE_IDX) continue;
+
+      capnp::FlatArrayMessageReader msg(e.words);
+      auto idx = msg.getRoot<cereal::Event>().getRoadEncodeIdx();
+      if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+        seg->frame_idx[idx.getFrameId()] = idx.getSegmentId();
+      }
+    }
+  }
+
+  LOGW("loaded %s: %zu events, %zu frames", path.c_str(), seg->log.events.size(), seg->frame_idx.size());
+  return seg;
+}
+
+class Replay {
+public:
+  Replay(double speed, const std::set<std::string> &allow, const std::set<std::string> &block)
+    : speed(speed), allow(allow), block(block) {
+    for (const auto &it : services) service_names.insert(it.name);
+  }
+
+  ~Replay() {
+    if (vipc_server) {
+      vipc_server.reset();
+      CL_CHECK(clReleaseContext(context));
+    }
+  }
+
+  bool vipc_started() const { return vipc_server != nullptr; }
+
+  // Creates camerad's road camera streams with the size of the first segment's video
+  void start_vipc(const FrameReader &frames) {
+    width = frames.width;
+    height = frames.height;
+
+    cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+    context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+    vipc_server = std::make_unique<VisionIpcServer>("camerad", device_id, context);
+    vipc_server->create_buffers(VISION_STREAM_RGB_BACK, RGB_BUF_COUNT, true, width, height);
+    vipc_server->create_buffers(VISION_STREAM_YUV_BACK, YUV_BUF_COUNT, false, width, height);
+    vipc_server->create_scaled_buffers(VISION_STREAM_YUV_BACK_HALF, YUV_BUF_COUNT, VISION_STREAM_YUV_BACK);
+    vipc_server->create_scaled_buffers(VISION_STREAM_YUV_BACK_QUARTER, YUV_BUF_COUNT, VISION_STREAM_YUV_BACK_HALF);
+    vipc_server->start_listener();
+  }
+
+  void play(Segment &seg) {
+    if (vipc_server && seg.has_frames && (seg.frames.width != width || seg.frames.height != height)) {
+      LOGE("%s has %dx%d frames instead of %dx%d, not sending them", seg.path.c_str(), seg.frames.width, seg.frames.height, width, height);
+      seg.has_frames = false;
+    }
+
+    for (const LogEvent &e : seg.log.events) {
+      if (do_exit) break;
+
+      Publisher *pub = get_publisher(e.which);
+      if (pub == nullptr) continue;
+
+      wait_until(e.mono_time, *pub);
+
+      capnp::FlatArrayMessageReader msg(e.words);
+      cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+      if (e.which == cereal::Event::ROAD_CAMERA_STATE && vipc_server && seg.has_frames) {
+        send_frame(seg, event.getRoadCameraState());
+      }
+
+      auto bytes = e.words.asBytes();
+      pub->sock->send((char *)bytes.begin(), bytes.size());
+      num_published++;
+    }
+  }
+
+  uint64_t num_published = 0;
+  uint64_t num_frames = 0;
+
+private:
+  Publisher *get_publisher(cereal::Event::Which which) {
+    auto it = publishers.find(which);
+    if (it != publishers.end()) return it->second.get();
+
+    // Events that aren't a service, like initData, or aren't replayed get a null publisher
+    std::unique_ptr<Publisher> pub;
+    KJ_IF_MAYBE(field, capnp::Schema::from<cereal::Event>().getFieldByDiscriminant(which)) {
+      std::string name = field->getProto().getName();
+      if (service_names.count(name) && (allow.empty() || allow.count(name)) && !block.count(name)) {
+        pub = std::make_unique<Publisher>();
+        pub->name = name;
+        pub->sock.reset(PubSocket::create(pm_context.get(), name));
+      }
+    }
+    return (publishers[which] = std::move(pub)).get();
+  }
+
+  // Sleeps until the event is due, or with speed 0 until the subscribers caught up.
+  // With SIM_CLOCK=1 both wait on the simulated clock, so replay paces to it and takes part in it
+  void wait_until(uint64_t mono_time, Publisher &pub) {
+    uint64_t now = nanos_since_boot();
+    if (route_start == 0) {
+      route_start = mono_time;
+      replay_start = now;
+    }
+
+    if (speed > 0) {
+      uint64_t due = replay_start + (mono_time - std::min(mono_time, route_start)) / speed;
+      if (due > now) sleep_until_nanos(due);
+      return;
+    }
+
+    // A service nobody subscribes to never updates, stop waiting for it after the first timeout
+    if (!pub.wait_for_subscribers) return;
+    while (!pub.sock->all_readers_updated() && !do_exit) {
+      if (nanos_since_boot() - now > MAX_SUBSCRIBER_WAIT_NS) {
+        LOGW("not waiting for subscribers of %s anymore", pub.name.c_str());
+        pub.wait_for_subscribers = false;
+        break;
+      }
+      if (sim_clock_t *c = sim_clock()) {
+        sim_clock_wait_until(c, nanos_since_boot() + 100000, [&] { return pub.sock->all_readers_updated(); });
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+  }
+
+  void send_frame(Segment &seg, cereal::FrameData::Reader frame_data) {
+    auto it = seg.frame_idx.find(frame_data.getFrameId());
+    if (it == seg.frame_idx.end()) return;
+
+    const AVFrame *frame = seg.frames.get(it->second);
+    if (frame == nullptr) return;
+
+    VisionBuf *yuv_buf = vipc_server->get_buffer(VISION_STREAM_YUV_BACK);
+    libyuv::I420Copy(frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2],
+                     yuv_buf->y, yuv_buf->stride, yuv_buf->u, yuv_buf->uv_stride, yuv_buf->v, yuv_buf->uv_stride, width, height);
+
+    // camerad's RGB streams are BGR
+    VisionBuf *rgb_buf = vipc_server->get_buffer(VISION_STREAM_RGB_BACK);
+    libyuv::I420ToRGB24(frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2],
+                        (uint8_t *)rgb_buf->addr, rgb_buf->stride, width, height);
+
+    VisionIpcBufExtra extra = {
+      frame_data.getFrameId(),
+      frame_data.getTimestampSof(),
+      frame_data.getTimestampEof(),
+    };
+    // Written on the CPU, nothing to sync from the device
+    vipc_server->send(rgb_buf, &extra, false);
+    vipc_server->send(yuv_buf, &extra, false);
+    num_frames++;
+  }
+
+  double speed;
+  std::set<std::string> allow, block, service_names;
+
+  std::unique_ptr<Context> pm_context{Context::create()};
+  std::map<cereal::Event::Which, std::unique_ptr<Publisher>> publishers;
+
+  uint64_t route_start = 0;
+  uint64_t replay_start = 0;
+
+  cl_context context = nullptr;
+  std::unique_ptr<VisionIpcServer> vipc_server;
+  int width = 0, height = 0;
+};
+
+int main(int argc, char *argv[]) {
+  double speed = 1.0;
+  bool vipc = true;
+  std::set<std::string> allow, block;
+
+  const struct option long_options[] = {
+    {"speed", required_argument, NULL, 's'},
+    {"allow", required_argument, NULL, 'a'},
+    {"block", required_argument, NULL, 'b'},
+    {"no-vipc", no_argument, NULL, 'n'},
+    {NULL, 0, NULL, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+    switch (opt) {
+      case 's': speed = atof(optarg); break;
+      case 'a': allow = split(optarg); break;
+      case 'b': block = split(optarg); break;
+      case 'n': vipc = false; break;
+      default: return 1;
+    }
+  }
+
+  if (optind >= argc || (speed != 0 && (speed < 0.1 || speed > 20))) {
+    fprintf(stderr, "usage: %s [--speed 0.1-20, 0 for as fast as possible] [--allow service,...] [--block service,...] [--no-vipc] <segment dir> ...\n", argv[0]);
+    return 1;
+  }
+  std::vector<std::string> segments(argv + optind, argv + argc);
+
+  Replay replay(speed, allow, block);
+
+  // The next segment is loaded while the current one plays
+  std::unique_ptr<Segment> seg = load_segment(segments[0], vipc);
+  for (size_t i = 0; i < segments.size() && !do_exit; i++) {
+    std::future<std::unique_ptr<Segment>> next;
+    if (i + 1 < segments.size()) {
+      next = std::async(std::launch::async, load_segment, segments[i + 1], vipc);
+    }
+
+    if (seg) {
+      if (vipc && seg->has_frames && !replay.vipc_started()) {
+        replay.start_vipc(seg->frames);
+      }
+      replay.play(*seg);
+      printf("%s: published %lu events and %lu frames\n", segments[i].c_str(), (unsigned long)replay.num_published, (unsigned long)replay.num_frames);
+    }
+
+    seg = next.valid() ? next.get() : nullptr;
+  }
+  return 0;
+}
@@ -108,6 +108,7 @@ void sensor_loop() {
     static const size_t numEvents = 16;
     sensors_event_t buffer[numEvents];
 
+    ReusableMessageBuilder builder;
     while (!do_exit) {
       int n = device->poll(device, buffer, numEvents);
       if (n == 0) continue;
@@ -123,7 +124,7 @@ void sensor_loop() {
         }
       }
 
-      MessageBuilder msg;
+      MessageBuilder &msg = builder.reset();
       auto sensor_events = msg.initEvent().initSensorEvents(log_events);
 
       int log_i = 0;
@@ -187,7 +188,7 @@ void sensor_loop() {
         log_i++;
       }
 
-      pm.send("sensorEvents", msg);
+      pm.send(ServiceId::sensorEvents, msg);
 
       if (re_init_sensors) {
         LOGE("Resetting sensors");
@@ -198,7 +199,7 @@ void sensor_loop() {
       // Check whether to go into low power mode at 5Hz
       if (frame % 20 == 0) {
         sm.update(0);
-        bool offroad = !sm["deviceState"].getDeviceState().getStarted();
+        bool offroad = !sm[ServiceId::deviceState].getDeviceState().getStarted();
         if (low_power_mode != offroad) {
           for (auto &s : sensors) {
             device->activate(device, s.first, 0);
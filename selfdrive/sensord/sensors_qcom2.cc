@@ -1,7 +1,5 @@
 #include <sys/resource.h>
 
-#include <chrono>
-#include <thread>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
@@ -80,12 +78,13 @@ int sensor_loop() {
   }
 
   PubMaster pm({"sensorEvents"});
+  ReusableMessageBuilder builder;
 
   while (!do_exit) {
-    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    uint64_t begin = nanos_since_boot();
 
     const int num_events = sensors.size();
-    MessageBuilder msg;
+    MessageBuilder &msg = builder.reset();
     auto sensor_events = msg.initEvent().initSensorEvents(num_events);
 
     for (int i = 0; i < num_events; i++) {
@@ -93,10 +92,9 @@ int sensor_loop() {
       sensors[i]->get_event(event);
     }
 
-    pm.send("sensorEvents", msg);
+    pm.send(ServiceId::sensorEvents, msg);
 
-    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::milliseconds(10) - (end - begin));
+    sleep_until_nanos(begin + 10000000ULL);
   }
   return 0;
 }
@@ -38,6 +38,7 @@ PROCS = {
   "./proclogd": 1.54,
   "selfdrive.logmessaged": 0.2,
   "./clocksd": 0.02,
+  "./latencyd": 0.5,
   "./ubloxd": 0.02,
   "selfdrive.tombstoned": 0,
   "./logcatd": 0,
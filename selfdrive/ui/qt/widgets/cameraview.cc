@@ -172,8 +172,13 @@ void CameraViewWidget::paintGL() {
   glBindTexture(GL_TEXTURE_2D, texture[latest_frame->idx]->frame_tex);
   if (!Hardware::EON()) {
     // this is handled in ion on QCOM
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, latest_frame->stride / 3);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, latest_frame->width, latest_frame->height,
                   0, GL_RGB, GL_UNSIGNED_BYTE, latest_frame->addr);
+    // Back to the defaults, the rest of the UI uploads with them
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
   }
 
   glUseProgram(gl_shader->prog);